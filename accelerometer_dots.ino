@@ -28,6 +28,15 @@
 #include "flickering_lights.h"
 #include "pulsing_dots.h"
 #include "arduino_utilities.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "display_controller.h"
+#include "i2c_clock.h"
+#include "motion_sleep.h"
+#include "panel_map.h"
+#include "scheduler.h"
+#include "brightness.h"
+#include "gesture.h"
 
 
 // Defines -----------------------------------------------------------------
@@ -43,9 +52,26 @@ Adafruit_LIS3DH lis = Adafruit_LIS3DH();
 #define DISPLAY1 0x74        // I2C address of Charlieplex matrix
 #define DISPLAY2 0x77        // I2C address of Charlieplex matrix
 
-//#define Z_IS_UP   // our dev board has z up but in production the boards are standing up(sidedown)
+// which I2C bus each matrix is wired to, the accelerometer always lives on Wire (bus 0)
+#define DISPLAY1_BUS 0
+#ifdef SECOND_I2C_BUS
+#define DISPLAY2_BUS 1       // its own wires, so it gets its own calibrated clock
+#else
+#define DISPLAY2_BUS 0
+#endif
+
 #define USE_ACCELEROMETER
 #define RENDER_DOTS
+#define USE_TELEMETRY      // live tuning over Serial, see telemetry.h (don't mix with DUMP_PULSE)
+#define GESTURE_MODES      // shake, flip or tilt-hold the jar to change looks (see gesture.h)
+
+#if defined( MOTION_SLEEP ) && !defined( USE_ACCELEROMETER )
+#error MOTION_SLEEP needs the accelerometer
+#endif
+
+#if defined( GESTURE_MODES ) && !defined( USE_ACCELEROMETER )
+#error GESTURE_MODES needs the accelerometer
+#endif
 
 #ifndef ARDUINO_SAMD_ZERO
 // turn this define on for power savings on boards that support it
@@ -55,105 +81,70 @@ Adafruit_LIS3DH lis = Adafruit_LIS3DH();
 
 // Constants -----------------------------------------------------------------
 
-static const bool     kShouldErase    = true;
+// live tunable, kEraseMode_Decay leaves trails behind moving dots
+static LiveSettings   s_settings = { 0.5f, kEraseMode_Clear, kFrameDelayMS, false };
 
-static uint8_t        s_display_one_page = 0;     // Front/back buffer control
+static const uint8_t  kAccelBus   = 0;
+static const uint8_t  kAccelMount = kAccelMount_Standing;   // kAccelMount_Flat on our dev board, which has z up
+
+// where each matrix sits in the render buffer and how it is turned on the mount (see panel_map.h),
+// the tilt direction follows the first one
+typedef PanelLayout< Matrix16x9Wiring, kMaxWidth, 0, 0 >              Panel1Layout;
+typedef PanelLayout< Matrix16x9Wiring, kMaxWidth, 0, kDeviceHeight >  Panel2Layout;
+
+static_assert( panel_layout_fits< Panel1Layout >( kMaxWidth * kMaxHeight ), "display 1 doesn't fit the render buffer" );
 #ifdef TWO_DISPLAYS
-static uint8_t        s_display_two_page = 0;     // Front/back buffer control for second display
+static_assert( panel_layout_fits< Panel2Layout >( kMaxWidth * kMaxHeight ), "display 2 doesn't fit the render buffer" );
 #endif
 
+// each matrix's gamma curve, e.g. GammaCurve< kPanelGamma, RangeCalibration< 0, 230 > > to tame a brighter one
+typedef PanelGamma                                                    Panel1Curve;
+typedef PanelGamma                                                    Panel2Curve;
 
-#pragma mark -
+static DisplayPanel   s_panels[] =
+{
+  { DISPLAY1, DISPLAY1_BUS, 0, Panel1Layout::table(), Panel1Curve::table() },
+#ifdef TWO_DISPLAYS
+  { DISPLAY2, DISPLAY2_BUS, 0, Panel2Layout::table(), Panel2Curve::table() },
+#endif
+};
+static const uint8_t  kPanelCount = sizeof( s_panels ) / sizeof( s_panels[0] );
 
+static bool           s_first_frame      = true;  // for timing boot to first frame
 
-// UTILITY FUNCTIONS -------------------------------------------------------
+// task rates (see scheduler.h).  The presenter runs at the target frame rate, render and upload
+// twice as often so they can get ahead into the frame queue (see display_controller.h) while there is room.
+static const uint32_t kFlickerPeriodUS   = 10000;   // well under the shortest flicker blip
+static const uint32_t kAccelPeriodUS     = 10000;   // matches the LIS3DH data rate set up below
+static const uint32_t kFramePeriodUS     = 33333;   // 30 fps, plus the live frame delay
+static const uint32_t kPresentDeadlineUS = 1000;    // ahead of everything else that is due, it only writes the Picture register
 
-// The full IS31FL3731 library is NOT used by this code.  Instead, 'raw'
-// writes are made to the matrix driver.  This is to maximize the space
-// available for animation data.  Use the Adafruit_IS31FL3731 and
-// Adafruit_GFX libraries if you need to do actual graphics stuff.
+static uint8_t        s_render_task      = 0;
+static uint8_t        s_upload_task      = 0;
+static uint8_t        s_present_task     = 0;
+static uint16_t       s_frame_delay_ms   = kFrameDelayMS;
+static bool           s_frame_ready      = false;
+static uint32_t       s_render_us        = 0;       // the ready frame's render, its upload adds to it for the frame stage
 
-// Begin I2C transmission and write register address (data then follows)
-void writeRegister( uint8_t address, uint8_t n ) 
-{
-  Wire.beginTransmission( address );
-  Wire.write( n );
-  // Transmission is left open for additional writes
-}
+#ifdef USE_ACCELEROMETER
+static sensors_event_t s_accel_event     = {0};     // latest reading, the render picks it up
+#endif
 
-// Select one of eight IS31FL3731 pages, or Function Registers
-void pageSelect( uint8_t address, uint8_t n ) 
-{
-  writeRegister( address, 0xFD ); // Command Register
-  Wire.write( n );       // Page number (or 0xB = Function Registers)
-  Wire.endTransmission();
-}
+#ifdef GESTURE_MODES
+// shake and tilt-hold right step forward through these, tilt-hold left steps back, a flip goes back to the first
+static const uint8_t  s_gesture_modes[]  = { kDotsMode_BlobAccel, kDotsMode_Cloud, kDotsMode_Disappearing, kDotsMode_DisappearingAccel };
+static const uint8_t  kGestureModeCount  = sizeof( s_gesture_modes ) / sizeof( s_gesture_modes[0] );
+#endif
 
 
-void setup_display_controller( uint8_t address ) 
-{
-  uint8_t i;
-  pageSelect( address, 0x0B );             // Access the Function Registers
-  writeRegister( address, 0 );             // Starting from first...
-
-  // Clear all except Shutdown
-  for( i = 0; i < 13; i++ ) 
-    Wire.write(10 == i); 
-  Wire.endTransmission();
-  
-  for( int p = 0; p < 2; p++ ) 
-  {                                          // For each page used (0 & 1)...
-    pageSelect( address, p );                // Access the Frame Registers
-    writeRegister( address, 0 );             // Start from 1st LED control reg
-    for( i = 0; i < 18; i++ ) 
-      Wire.write( 0xFF );                    // Enable all LEDs (18*8=144)
-    
-    for( int byteCounter = i + 1; i < 0xB4; i++ ) 
-    {                                        // For blink & PWM registers...
-      Wire.write( 0 );                       // Clear all
-      if( ++byteCounter >= 32 ) 
-      {                                      // Every 32 bytes...
-        byteCounter = 1;                     // End I2C transmission and
-        Wire.endTransmission();              // start a new one because
-        writeRegister( address, i );         // Wire buf is only 32 bytes.
-      }
-    }
-    Wire.endTransmission();
-  }
-}
+// Private API -----------------------------------------------------------------
 
-
-void buffer_frame( uint8_t address, const uint8_t* buff, uint8_t* page ) 
-{
-  uint8_t  a, x1, y1, x2, y2, x, y;
-
-  // Display frame rendered on prior pass.  This is done at function start
-  // (rather than after rendering) to ensire more uniform animation timing.
-  pageSelect( address, 0x0B );    // Function registers
-  writeRegister( address, 0x01 ); // Picture Display reg
-  Wire.write( *page );            // Page #
-  Wire.endTransmission();
-
-  *page ^= 1; // Flip front/back buffer index
-
-  // Write buff to matrix (not actually displayed until next pass)
-  pageSelect( address, *page );    // Select background buffer
-  writeRegister( address, 0x24 ); // First byte of PWM data
-  uint8_t i = 0, byteCounter = 1;
-  for( uint8_t x = 0; x < kDeviceHeight; x++ ) 
-  {
-    for( uint8_t y = 0; y < kDeviceWidth; y++ ) 
-    {
-      Wire.write( buff[i++] );    // Write each byte to matrix
-      if( ++byteCounter >= 32 ) 
-      {                                     // Every 32 bytes...
-        Wire.endTransmission();             // end transmission and
-        writeRegister( address, 0x24 + i ); // start a new one (Wire lib limits)
-      }
-    }
-  }
-  Wire.endTransmission();
-}
+void flicker_task();
+void accel_task();
+void render_task();
+void upload_task();
+void present_task();
+void gesture_mode( uint8_t gesture );
 
 
 #pragma mark -
@@ -167,126 +158,229 @@ void setup()
     utilities_setup();
     flickering_lights_setup();
     pulsing_dots_setup();
+    profiler_reset();
+#ifdef USE_TELEMETRY
+    telemetry_setup( &s_settings );
+#endif
     
 #ifdef POWER_SAVINGS
   power_all_disable(); // Stop peripherals: ADC, timers, etc. to save power
   power_twi_enable();  // But switch I2C back on; need it for display
+  power_timer0_enable(); // and Timer0, the scheduler runs off micros() and idles in SLEEP_MODE_IDLE
   DIDR0 = 0x0F;        // Digital input disable on A0-A3
 #endif // POWER_SAVINGS   
 
-  Wire.begin();                            // Initialize I2C
-#ifdef ARDUINO_SAMD_ZERO
-  Wire.setClock( 400000 );                 // 400 kHz I2C - Feather M0
-#else  
-  // The TWSR/TWBR lines are AVR-specific and won't work on other MCUs.
-  TWSR = 0;                                // I2C prescaler = 1
-  TWBR = (F_CPU / 400000 - 16) / 2;        // 400 KHz I2C
-#endif  // ARDUINO_SAMD_ZERO
-
-  // setup the LED controllers
-  setup_display_controller( DISPLAY1 ); 
-#ifdef TWO_DISPLAYS  
-  setup_display_controller( DISPLAY2 );
-#endif
+  i2c_begin();                             // Initialize I2C, 400 kHz to start with, calibrated below
+
+  // setup the LED controllers, skipped when they kept their setup through a reset
+  for( uint8_t i = 0; i < kPanelCount; i++ )
+  {
+    if( display_setup( s_panels[i].bus, s_panels[i].address, &s_panels[i].page ) )
+    {
+      Serial.print( "display " );
+      Serial.print( i + 1 );
+      Serial.println( " warm" );
+    }
+  }
+
+  // find the fastest clock the displays on each bus can take
+  display_calibrate( s_panels, kPanelCount );
+  display_queue_reset( s_panels );
 
 #ifdef USE_ACCELEROMETER
   if( !lis.begin( 0x18 ) ) 
     Serial.println( "Couldnt start accelerometer" );
   else
+  {
     lis.setRange( LIS3DH_RANGE_4_G );   // 2, 4, 8 or 16 G!
+    lis.setDataRate( LIS3DH_DATARATE_100_HZ );
+  }
 #endif   // USE_ACCELEROMETER
 
-#ifdef POWER_SAVINGS
-  // Enable the watchdog timer, set to a ~32 ms interval (about 31 Hz)
-  // This provides a sufficiently steady time reference for animation,
-  // allows timer/counter peripherals to remain off (for power saving)
-  // and can power-down the chip after processing each frame.
-  set_sleep_mode(SLEEP_MODE_PWR_DOWN); // Deepest sleep mode (WDT wakes)
-  noInterrupts();
-  MCUSR  &= ~_BV(WDRF);
-  WDTCSR  =  _BV(WDCE) | _BV(WDE);     // WDT change enable
-  WDTCSR  =  _BV(WDIE) | _BV(WDP0);    // Interrupt enable, ~32 ms
-  interrupts();
-  // Peripheral and sleep savings only amount to about 10 mA, but this
-  // may provide nearly an extra hour of run time before battery depletes.
-#endif  // POWER_SAVINGS
+#ifdef MOTION_SLEEP
+  motion_sleep_setup( kAccelBus );
+#endif
+
+#ifdef GESTURE_MODES
+  uint8_t up_axis;
+  int8_t  up_sign;
+  panel_accel_up( kAccelMount, kPanelRotate_0, kPanelMirror_None, &up_axis, &up_sign );    // the same axes accel_task() hands over
+  gesture_setup( up_axis, up_sign );
+#endif
+
+  scheduler_add( flicker_task, kProfile_Flicker, kFlickerPeriodUS, 0 );
+#ifdef USE_ACCELEROMETER
+  scheduler_add( accel_task, kProfile_Accel, kAccelPeriodUS, 0 );
+#endif
+#ifdef RENDER_DOTS
+  s_render_task  = scheduler_add( render_task, kProfile_Render, (kFramePeriodUS + s_frame_delay_ms * 1000UL) / 2, 0 );
+  s_upload_task  = scheduler_add( upload_task, kProfile_Upload, (kFramePeriodUS + s_frame_delay_ms * 1000UL) / 2, 0 );
+  s_present_task = scheduler_add( present_task, kProfile_Present, kFramePeriodUS + s_frame_delay_ms * 1000UL, kPresentDeadlineUS );
+#endif
+  scheduler_start();
 }
 
 
 #pragma mark -
 
-// LOOP FUNCTION - RUNS EVERY FRAME ----------------------------------------
+// LOOP FUNCTION - RUNS WHATEVER IS DUE ------------------------------------
 
 void loop() 
 {
-#ifdef POWER_SAVINGS
-  power_twi_enable();
+  scheduler_run();
+
+#ifdef MOTION_SLEEP
+  // faded all the way out, nothing else happens until we get picked up
+  if( motion_sleep_due() )
+  {
+    motion_sleep( s_panels, kPanelCount );
+    display_queue_reset( s_panels );    // whatever was queued was on its way to black
+    scheduler_start();      // don't count the time asleep as missed frames
+#ifdef GESTURE_MODES
+    gesture_reset();        // it may have been moved while we slept
+#endif
+  }
 #endif
+}
+
+
+#pragma mark -
 
+// TASKS -----------------------------------------------------------------
+
+void flicker_task()
+{
   flickering_lights_tick();
+}
+
 
 #ifdef USE_ACCELEROMETER
-  float           accel_scale = 0.5f;
-  sensors_event_t event       = {0}; 
-  lis.getEvent( &event );  
-//  Serial.print( "x: " ); Serial.println( event.acceleration.x );
+void accel_task()
+{
+  i2c_use_clock( kAccelBus, kI2CDefaultClock );    // the LIS3DH tops out at 400 kHz
+  lis.getEvent( &s_accel_event );
+//  Serial.print( "x: " ); Serial.println( s_accel_event.acceleration.x );
+
+#ifdef GESTURE_MODES
+  // in the jar's own axes rather than the panel's, and straight from the raw counts getEvent() left behind
+  int16_t x, y, z;
+  panel_remap_accel( kAccelMount, kPanelRotate_0, kPanelMirror_None, lis.x, lis.y, lis.z, &x, &y, &z );
+  gesture_mode( gesture_sample( x, y, z ) );
+#endif
+}
 #endif  // USE_ACCELEROMETER
 
+
+#ifdef GESTURE_MODES
+void gesture_mode( uint8_t gesture )
+{
+  if( gesture == kGesture_None )
+    return;
+
+  // a mode picked over telemetry that isn't in the cycle steps forward onto the first one
+  uint8_t current = kGestureModeCount - 1;
+  for( uint8_t i = 0; i < kGestureModeCount; i++ )
+  {
+    if( s_gesture_modes[i] == pulsing_dots_get_mode() )
+      current = i;
+  }
+
+  uint8_t next = 0;
+  if( gesture == kGesture_Shake || gesture == kGesture_TiltRight )
+    next = (current + 1) % kGestureModeCount;
+  else if( gesture == kGesture_TiltLeft )
+    next = (current + kGestureModeCount - 1) % kGestureModeCount;
+
+  pulsing_dots_set_mode( s_gesture_modes[next] );
+}
+#endif  // GESTURE_MODES
+
+
 #ifdef RENDER_DOTS
-//    uint32_t start_time = millis();
+void render_task()
+{
+  // the frame delay is live tunable and stretches the frame period, changed here while the
+  // upload of this frame is still due so the two stay released together
+  if( s_settings.frame_delay_ms != s_frame_delay_ms )
+  {
+    s_frame_delay_ms = s_settings.frame_delay_ms;
+    scheduler_set_period( s_render_task, (kFramePeriodUS + s_frame_delay_ms * 1000UL) / 2, 0 );
+    scheduler_set_period( s_upload_task, (kFramePeriodUS + s_frame_delay_ms * 1000UL) / 2, 0 );
+    scheduler_set_period( s_present_task, kFramePeriodUS + s_frame_delay_ms * 1000UL, kPresentDeadlineUS );
+  }
+
+  // nothing to do until the presenter frees up a page, or the last frame has gone out
+  if( s_frame_ready || display_queue_full() )
+    return;
+
+  // render a frame - about 19ms on Pro Trinket 12Mhz
+  uint32_t start = micros();
 
-    // render a frame - about 19ms on Pro Trinket 12Mhz
 #ifdef USE_ACCELEROMETER
-  #ifdef Z_IS_UP
-    // display is laying down = Z is up
-    pulsing_dots_draw( event.acceleration.y * accel_scale, event.acceleration.x * accel_scale, event.acceleration.z * accel_scale, kShouldErase );
-  #else
-    // display is standing vertically - Y is up
-    pulsing_dots_draw( event.acceleration.z * accel_scale, -event.acceleration.y * accel_scale, event.acceleration.x * accel_scale, kShouldErase );
-  #endif // Z_IS_UP
+  float accel_scale = s_settings.accel_scale;
+  float x, y, z;
+  panel_remap_accel( kAccelMount, Panel1Layout::kRotation, Panel1Layout::kMirror, s_accel_event.acceleration.x, s_accel_event.acceleration.y, s_accel_event.acceleration.z, &x, &y, &z );
+  pulsing_dots_draw( x * accel_scale, y * accel_scale, z * accel_scale, s_settings.erase_mode );
 #else
-    pulsing_dots_draw( 0, 0, 0, kShouldErase );
+  pulsing_dots_draw( 0, 0, 0, s_settings.erase_mode );
 #endif  // USE_ACCELEROMETER
 
-//    uint32_t render_time = millis() - start_time;
-//    Serial.print( "render_time (ms): " ); Serial.println( render_time );
-
-    // output the frame
-    uint8_t* buf = pulsing_dots_get_render_buffer();
-    buffer_frame( DISPLAY1, buf, &s_display_one_page );
-#ifdef TWO_DISPLAYS
-    buffer_frame( DISPLAY2, &buf[144], &s_display_two_page );
+  uint8_t* buf = pulsing_dots_get_render_buffer();
+  flickering_lights_draw( buf, kMaxWidth );    // flicker channels that live on the matrix go on top of the dots
+#ifdef MOTION_SLEEP
+  // folded into the panels' brightness luts, so fading out costs nothing per pixel
+  brightness_set_fade( motion_sleep_tick( s_accel_event.acceleration.x, s_accel_event.acceleration.y, s_accel_event.acceleration.z ) );
 #endif
-    
-    // Total render time about 60ms on Pro Trinket 12Mhz (so 40ms spent talking over i2c)
-//    uint32_t elapsed_time = millis() - start_time;
-//    Serial.print( "elapsed_time (ms): " ); Serial.println( elapsed_time );
-#else
-    // Total render time about 60ms on Pro Trinket 12Mhz
-    delay( 60 );
-#endif // RENDER_DOTS
 
-  if( kFrameDelayMS )
-    delay( kFrameDelayMS );
- 
-#ifdef POWER_SAVINGS
-  power_twi_disable(); // I2C off (see comment at top of function)
-  sleep_enable();
-  interrupts();
-  sleep_mode();        // Power-down MCU.
-  // Code will resume here on wake; loop() returns and is called again
-#endif // POWER_SAVINGS
+  s_frame_ready = true;
+  s_render_us   = micros() - start;
 }
 
 
-// Interrupt service routines ----------------------------------------
+void upload_task()
+{
+  // released with the render, so it only finds nothing to send when the render was skipped
+  if( !s_frame_ready )
+    return;
+
+  // output the frame - Total render time about 60ms on Pro Trinket 12Mhz (so 40ms spent talking over i2c)
+  uint32_t start = micros();
+  uint8_t* buf = pulsing_dots_get_render_buffer();
+  if( s_settings.recalibrate )
+  {
+    display_calibrate( s_panels, kPanelCount );
+    s_settings.recalibrate = false;
+  }
 
-#ifdef POWER_SAVINGS
-ISR( WDT_vect ) 
-{ 
-    // Watchdog timer interrupt (does nothing, but required)
-} 
+  buffer_frames( s_panels, kPanelCount, buf );
+  s_frame_ready = false;
+  profiler_record( kProfile_Frame, s_render_us + (micros() - start) );    // the two tasks' own time, not the gap between them
+
+#ifdef USE_TELEMETRY
+  telemetry_tick( buf, kMaxWidth, kMaxHeight );
 #endif
+}
+
+
+void present_task()
+{
+  if( !display_present( s_panels, kPanelCount ) )
+    return;
+#ifdef MOTION_SLEEP
+  motion_sleep_frame_shown();
+#endif
+
+  // the boot stage is never started so it times from reset
+  if( s_first_frame )
+  {
+    profiler_stop( kProfile_Boot );
+    s_first_frame = false;
+  }
+}
+#endif // RENDER_DOTS
+
+
+// the watchdog interrupt lives in motion_sleep.cpp, it is only used while MOTION_SLEEP sleeps
 
 // EOF
 
@@ -0,0 +1,64 @@
+//
+//  brightness.cpp
+//
+
+#include "brightness.h"
+
+
+// Constants and static data ---------------------------------------------
+
+static uint16_t       s_level     = kBrightnessFull;
+static uint16_t       s_fade      = kBrightnessFull;
+static uint16_t       s_effective = kBrightnessFull;
+
+
+// Code -----------------------------------------------------------------
+
+void brightness_set_level( uint16_t level )
+{
+  s_level     = level > kBrightnessFull ? kBrightnessFull : level;
+  s_effective = (uint16_t)(((uint32_t)s_level * s_fade) >> 8);     // 256 x 256 doesn't fit an AVR int
+}
+
+
+uint16_t brightness_get_level()
+{
+  return s_level;
+}
+
+
+void brightness_set_fade( uint16_t fade )
+{
+  s_fade      = fade > kBrightnessFull ? kBrightnessFull : fade;
+  s_effective = (uint16_t)(((uint32_t)s_level * s_fade) >> 8);     // 256 x 256 doesn't fit an AVR int
+}
+
+
+uint16_t brightness_effective()
+{
+  return s_effective;
+}
+
+
+uint8_t brightness_dim( uint8_t value )
+{
+  return (value * s_effective) >> 8;
+}
+
+
+#ifdef BRIGHTNESS_RAM_LUT
+bool brightness_update_lut( uint8_t* lut, uint16_t* lut_level, const uint8_t* curve )
+{
+  if( *lut_level == s_effective )
+    return false;
+
+  // the PWM is linear in light, so dimming is a straight scale of the curve's output
+  for( uint16_t i = 0; i < kBrightnessLUTSize; i++ )
+    lut[i] = brightness_map( curve, i, s_effective );
+
+  *lut_level = s_effective;
+  return true;
+}
+#endif
+
+// EOF
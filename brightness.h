@@ -0,0 +1,143 @@
+//
+//  brightness.h
+//
+//  Everything between a linear intensity in the render buffer and the PWM value a panel gets.
+//  Each panel has a gamma curve, optionally bent by a calibration for that panel, generated at
+//  compile time into PROGMEM.  The global brightness level (night mode, power limits, the
+//  motion sleep fade) is multiplied into a RAM copy of the curve only when the level changes,
+//  and the upload looks every pixel up in that copy as it goes out - dimming costs nothing
+//  per frame.  The Pro Trinket can't spare 256 bytes of RAM a panel for the copy, so there
+//  each pixel is read from the PROGMEM curve and scaled as it goes out instead.
+//
+
+#ifndef brightness_h
+#define brightness_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+#include "static_table.h"
+
+
+// Defines -----------------------------------------------------------------
+
+// every brightness ceiling in one place, all linear intensities (before the gamma curve)
+static const uint8_t  kMaxBrightness        = 220;    // ordinary dots are rolled up to this
+static const uint8_t  kOverBrightness       = 255;    // the few exceptionally bright dots
+static const uint8_t  kFlickerMaxBrightness = 220;    // fluorescent flicker channels when fully on
+
+static const uint16_t kPanelGamma           = 280;    // exponent x 100, 2.8 is what the IS31FL3731 matrices want
+static const uint16_t kBrightnessFull       = 256;    // levels and fades are factor/256 like pixel_scale()
+static const uint16_t kBrightnessLUTSize    = 256;
+
+// a multiply a pixel is nothing next to its I2C time, the RAM isn't
+#ifndef __AVR__
+#define BRIGHTNESS_RAM_LUT
+#endif
+
+
+// Compile time math -----------------------------------------------------------------
+//
+// C++11 constexpr can't call into libm, this is just enough of pow() to build tables with
+
+constexpr double brightness_ln_series( double y2, double term, uint8_t k )
+{
+  return k > 25 ? 0 : term / (2 * k + 1) + brightness_ln_series( y2, term * y2, k + 1 );
+}
+
+// ln( x ) through atanh, which converges quickly once x is doubled up into [0.5, 1]
+constexpr double brightness_ln( double x )
+{
+  return x < 0.5 ? brightness_ln( x * 2 ) - 0.69314718055994531 :
+                   2 * brightness_ln_series( ((x - 1) / (x + 1)) * ((x - 1) / (x + 1)), (x - 1) / (x + 1), 0 );
+}
+
+constexpr double brightness_exp_series( double z, double term, uint8_t k )
+{
+  return k > 20 ? term : term + brightness_exp_series( z, term * z / k, k + 1 );
+}
+
+constexpr double brightness_square( double v )
+{
+  return v * v;
+}
+
+// exp( z ) as exp( z / 16 )^16 so the series stays short
+constexpr double brightness_exp( double z )
+{
+  return brightness_square( brightness_square( brightness_square( brightness_square( brightness_exp_series( z / 16, 1, 1 ) ) ) ) );
+}
+
+constexpr double brightness_pow( double x, double e )
+{
+  return x <= 0 ? 0 : brightness_exp( e * brightness_ln( x ) );
+}
+
+
+// Curves -----------------------------------------------------------------
+
+// the panel's PWM as it comes out of the gamma curve
+struct FlatCalibration
+{
+  static constexpr uint8_t apply( uint8_t pwm )  { return pwm; }
+};
+
+// squeeze a panel's PWM range: Floor is the lowest PWM that visibly lights its LEDs,
+// Ceiling brings a brighter panel down to match its neighbours
+template< uint8_t Floor, uint8_t Ceiling >
+struct RangeCalibration
+{
+  static constexpr uint8_t apply( uint8_t pwm )  { return pwm ? Floor + (pwm * (Ceiling - Floor) + 127) / 255 : 0; }
+};
+
+
+// linear intensity -> PWM, a generator for StaticTable
+template< uint16_t Gamma100, class Calibration = FlatCalibration >
+struct GammaCurve
+{
+  typedef uint8_t value_type;
+
+  static const uint16_t kCount = kBrightnessLUTSize;
+
+  static constexpr uint8_t value( uint16_t i )
+  {
+    return Calibration::apply( (uint8_t)(brightness_pow( i / 255.0, Gamma100 / 100.0 ) * 255.0 + 0.5) );
+  }
+
+  static const uint8_t* table()   { return StaticTable< GammaCurve >::table; }
+};
+
+typedef GammaCurve< kPanelGamma > PanelGamma;
+
+// the curve that used to be pasted in by hand, these keep the generated one honest
+static_assert( PanelGamma::value( 28 ) == 1 && PanelGamma::value( 64 ) == 5 && PanelGamma::value( 131 ) == 39, "gamma 2.8 drifted" );
+static_assert( PanelGamma::value( 0 ) == 0 && PanelGamma::value( 200 ) == 129 && PanelGamma::value( 255 ) == 255, "gamma 2.8 drifted" );
+
+
+// Public API -----------------------------------------------------------------
+
+// the global level, for night mode and power limits (0..kBrightnessFull)
+void     brightness_set_level( uint16_t level );
+uint16_t brightness_get_level();
+
+// a second factor on top of the level, for fades that shouldn't disturb it (motion sleep)
+void     brightness_set_fade( uint16_t fade );
+
+uint16_t brightness_effective();                // level and fade together
+uint8_t  brightness_dim( uint8_t value );       // one value by the effective level, for the odd PWM pin
+
+// one value through a PROGMEM curve and then a level, what a lut entry holds
+inline uint8_t brightness_map( const uint8_t* curve, uint8_t value, uint16_t level )
+{
+  return (pgm_read_byte( &curve[value] ) * level) >> 8;
+}
+
+#ifdef BRIGHTNESS_RAM_LUT
+// refresh a RAM lookup table from its PROGMEM curve when the effective level has moved on since
+// it was last built, returns true when it was rebuilt.  A zeroed table at level 0 is already valid.
+bool     brightness_update_lut( uint8_t* lut, uint16_t* lut_level, const uint8_t* curve );
+#endif
+
+
+#endif // brightness_h
+// EOF
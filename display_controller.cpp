@@ -0,0 +1,380 @@
+//
+//  display_controller.cpp
+//
+
+#include <Wire.h>
+
+#include "display_controller.h"
+#include "i2c_clock.h"
+#include "panel_map.h"
+#include "brightness.h"
+
+
+// Defines -----------------------------------------------------------------
+
+// longest write we can hand Wire in one go, one byte of its buffer goes to the register address
+static const uint16_t kI2CBurstMax = kI2CWireBuffer - 1;
+
+static_assert( kDisplayPages <= kI2CScratchPage, "the frame queue would run into the calibration scratch page" );
+
+
+// Constants and static data ---------------------------------------------
+
+static DisplayQueue   s_queue = { 1, 1, 0, kDisplayQueueDefault, 0, 0 };
+static bool           s_priming = true;     // nothing presented since the queue was emptied, so nothing to underrun yet
+
+
+// Private API -----------------------------------------------------------------
+
+void    setup_page( uint8_t bus, uint8_t address, uint8_t page );
+bool    show_page( uint8_t bus, uint8_t address, uint8_t page );
+bool    write_byte( uint8_t bus, uint8_t address, uint8_t reg, uint8_t value );
+uint8_t next_page( uint8_t page );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+// Begin I2C transmission and write register address (data then follows)
+void writeRegister( uint8_t bus, uint8_t address, uint8_t n )
+{
+  TwoWire* wire = i2c_bus( bus );
+  wire->beginTransmission( address );
+  wire->write( n );
+  // Transmission is left open for additional writes
+}
+
+
+// Select one of eight IS31FL3731 pages, or Function Registers
+bool pageSelect( uint8_t bus, uint8_t address, uint8_t n )
+{
+  return write_byte( bus, address, kIS31_CommandRegister, n );    // Page number (or 0xB = Function Registers)
+}
+
+
+// every transaction below gets kI2CRetries more goes after a failure, and gives up as soon as one
+// runs out of them or the bus runs out of budget - the rest of a page isn't worth sending then
+
+// write a run of registers on the current page in as few transactions as Wire allows (the chip auto-increments)
+bool display_write( uint8_t bus, uint8_t address, uint8_t reg, const uint8_t* data, uint16_t count )
+{
+  TwoWire* wire = i2c_bus( bus );
+  while( count )
+  {
+    uint16_t burst = count < kI2CBurstMax ? count : kI2CBurstMax;
+    if( i2c_over_budget( bus ) )
+      return false;
+
+    for( uint8_t attempt = 0; ; attempt++ )
+    {
+      writeRegister( bus, address, reg );
+      wire->write( data, burst );
+      if( i2c_end( bus ) == 0 )
+        break;
+      if( attempt == kI2CRetries || !i2c_retry( bus ) )
+        return false;
+    }
+
+    reg   += burst;
+    data  += burst;
+    count -= burst;
+  }
+  return true;
+}
+
+
+// same, but every byte is looked up in the render buffer through the panel's map and then through its
+// curve and the brightness on its way out - the remap, gamma and dimming all ride along with the I2C copy
+bool display_write_mapped( const DisplayPanel* panel, uint8_t reg, const uint8_t* buff, uint16_t count )
+{
+  TwoWire*        wire  = i2c_bus( panel->bus );
+  const uint16_t* map   = panel->map;
+#ifndef BRIGHTNESS_RAM_LUT
+  uint16_t        level = brightness_effective();
+#endif
+  while( count )
+  {
+    uint16_t burst = count < kI2CBurstMax ? count : kI2CBurstMax;
+    if( i2c_over_budget( panel->bus ) )
+      return false;
+
+    for( uint8_t attempt = 0; ; attempt++ )
+    {
+      writeRegister( panel->bus, panel->address, reg );
+      for( uint16_t i = 0; i < burst; i++ )
+      {
+        uint16_t index = pgm_read_word( &map[i] );
+#ifdef BRIGHTNESS_RAM_LUT
+        wire->write( index == kPanelUnmapped ? 0 : panel->lut[buff[index]] );
+#else
+        wire->write( index == kPanelUnmapped ? 0 : brightness_map( panel->curve, buff[index], level ) );
+#endif
+      }
+      if( i2c_end( panel->bus ) == 0 )
+        break;
+      if( attempt == kI2CRetries || !i2c_retry( panel->bus ) )
+        return false;
+    }
+
+    reg   += burst;
+    map   += burst;
+    count -= burst;
+  }
+  return true;
+}
+
+
+bool display_read( uint8_t bus, uint8_t address, uint8_t reg, uint8_t* data, uint8_t count )
+{
+  TwoWire* wire = i2c_bus( bus );
+  for( uint8_t attempt = 0; ; attempt++ )
+  {
+    writeRegister( bus, address, reg );
+    if( i2c_end( bus ) == 0 && i2c_request( bus, address, count ) )
+      break;
+    if( attempt == kI2CRetries || !i2c_retry( bus ) )
+      return false;
+  }
+
+  for( uint8_t i = 0; i < count; i++ )
+    data[i] = wire->read();
+  return true;
+}
+
+
+#pragma mark -
+
+void setup_page( uint8_t bus, uint8_t address, uint8_t page )
+{
+  pageSelect( bus, address, page );
+
+  // LED control, blink and PWM registers are contiguous so the whole page goes out as a few full bursts:
+  // all LEDs enabled (18*8=144), no blink, everything black
+  uint8_t  burst[kI2CBurstMax];
+  uint8_t  reg = kIS31_LEDControl;
+  while( reg < kIS31_PageSize )
+  {
+    uint8_t count = (kIS31_PageSize - reg) < kI2CBurstMax ? (kIS31_PageSize - reg) : kI2CBurstMax;
+    for( uint8_t i = 0; i < count; i++ )
+      burst[i] = (reg + i < kIS31_Blink) ? 0xFF : 0;
+
+    display_write( bus, address, reg, burst, count );
+    reg += count;
+  }
+}
+
+
+// a controller that kept power through our reset still has its shutdown bit released and our pages enabled
+bool display_is_configured( uint8_t bus, uint8_t address )
+{
+  uint8_t regs[kIS31_FunctionRegisters];
+
+  pageSelect( bus, address, kIS31_FunctionPage );
+  if( !display_read( bus, address, 0, regs, sizeof( regs ) ) )
+    return false;
+
+  if( regs[kIS31_ShutdownRegister] != 1 || regs[kIS31_ConfigRegister] != 0 || regs[kIS31_PictureRegister] >= kDisplayPages )
+    return false;
+
+  for( uint8_t p = 0; p < kDisplayPages; p++ )
+  {
+    uint8_t enable[kIS31_Blink - kIS31_LEDControl];
+    pageSelect( bus, address, p );
+    if( !display_read( bus, address, kIS31_LEDControl, enable, sizeof( enable ) ) )
+      return false;
+
+    for( uint8_t i = 0; i < sizeof( enable ); i++ )
+    {
+      if( enable[i] != 0xFF )
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+bool display_setup( uint8_t bus, uint8_t address, uint8_t* page )
+{
+  if( display_is_configured( bus, address ) )
+  {
+    // pick up where we left off - keep showing the current page and queue frames into the ones after it
+    pageSelect( bus, address, kIS31_FunctionPage );
+    display_read( bus, address, kIS31_PictureRegister, page, 1 );
+    return true;
+  }
+
+  // pages first while the chip is still shut down, so nothing random flashes up
+  for( uint8_t p = 0; p < kDisplayPages; p++ )
+    setup_page( bus, address, p );
+
+  // then clear all function registers except Shutdown, which turns the display on showing page 0
+  uint8_t regs[kIS31_FunctionRegisters] = { 0 };
+  regs[kIS31_ShutdownRegister] = 1;
+  pageSelect( bus, address, kIS31_FunctionPage );
+  display_write( bus, address, 0, regs, sizeof( regs ) );
+
+  *page = 0;
+  return false;
+}
+
+
+bool display_shutdown( uint8_t bus, uint8_t address, bool shutdown )
+{
+  return pageSelect( bus, address, kIS31_FunctionPage ) && write_byte( bus, address, kIS31_ShutdownRegister, shutdown ? 0 : 1 );
+}
+
+
+#pragma mark -
+
+bool write_byte( uint8_t bus, uint8_t address, uint8_t reg, uint8_t value )
+{
+  return display_write( bus, address, reg, &value, 1 );
+}
+
+
+bool show_page( uint8_t bus, uint8_t address, uint8_t page )
+{
+  return pageSelect( bus, address, kIS31_FunctionPage ) && write_byte( bus, address, kIS31_PictureRegister, page );
+}
+
+
+void buffer_frames( DisplayPanel* panels, uint8_t count, const uint8_t* buff )
+{
+  if( s_queue.depth >= kDisplayQueueMax )
+    return;
+
+  bool ok[kI2CBusCount];
+  bool up[kI2CBusCount];      // false once a bus couldn't be recovered, it sits out the rest of the frame
+  for( uint8_t bus = 0; bus < kI2CBusCount; bus++ )
+  {
+    ok[bus] = true;
+    i2c_set_budget( bus, kI2CFrameBudgetUS );
+    up[bus] = i2c_lines_idle( bus ) || i2c_recover( bus );
+    i2c_use_clock( bus, i2c_calibrated_clock( bus ) );
+  }
+
+  uint8_t page = s_queue.tail;
+  uint8_t mask = 1 << page;
+  for( uint8_t i = 0; i < count; i++ )
+  {
+    DisplayPanel* panel = &panels[i];
+#ifdef BRIGHTNESS_RAM_LUT
+    brightness_update_lut( panel->lut, &panel->lut_level, panel->curve );     // only does anything when the level moved
+#endif
+
+    // a bad bus or one out of time for this frame drops the panel's upload, and a panel that has
+    // been missing frames can still be showing this page - it keeps showing its last whole frame
+    // and catches up on a later one
+    bool sent = up[panel->bus] && panel->page != page &&
+                pageSelect( panel->bus, panel->address, page ) &&
+                display_write_mapped( panel, kIS31_PWM, buff, kIS31_PWMBytes );
+
+    if( sent )
+      panel->stale &= ~mask;
+    else
+    {
+      panel->stale  |= mask;
+      ok[panel->bus] = false;
+      up[panel->bus] = up[panel->bus] && i2c_lines_idle( panel->bus );
+      i2c_count_skip( panel->bus );
+    }
+  }
+
+  s_queue.tail = next_page( page );
+  s_queue.depth++;
+
+  for( uint8_t bus = 0; bus < kI2CBusCount; bus++ )
+  {
+    i2c_set_budget( bus, 0 );
+    i2c_report_upload( bus, ok[bus] );
+  }
+}
+
+
+bool display_present( DisplayPanel* panels, uint8_t count )
+{
+  if( !s_queue.depth )
+  {
+    if( !s_priming )
+      s_queue.underruns++;
+    return false;
+  }
+
+  // every panel flips in the same tick so a tiled installation changes frames together, a held
+  // bus is left for the next upload to recover rather than holding up the presenter
+  uint8_t page = s_queue.head;
+  for( uint8_t i = 0; i < count; i++ )
+  {
+    DisplayPanel* panel = &panels[i];
+    if( (panel->stale & (1 << page)) || !i2c_lines_idle( panel->bus ) )
+      continue;
+
+    i2c_use_clock( panel->bus, i2c_calibrated_clock( panel->bus ) );
+    if( show_page( panel->bus, panel->address, page ) )
+      panel->page = page;
+  }
+
+  s_queue.head = next_page( page );
+  s_queue.depth--;
+  s_queue.presented++;
+  s_priming = false;
+  return true;
+}
+
+
+#pragma mark -
+
+void display_queue_reset( const DisplayPanel* panels )
+{
+  // start writing just past what the first panel shows, a warm restart can leave it on any page
+  s_queue.head  = next_page( panels[0].page );
+  s_queue.tail  = s_queue.head;
+  s_queue.depth = 0;
+  s_priming     = true;
+}
+
+
+void display_queue_set_target( uint8_t frames )
+{
+  s_queue.target = frames < 1 ? 1 : (frames > kDisplayQueueMax ? kDisplayQueueMax : frames);
+}
+
+
+bool display_queue_full()
+{
+  return s_queue.depth >= s_queue.target;
+}
+
+
+const DisplayQueue* display_queue()
+{
+  return &s_queue;
+}
+
+
+uint8_t next_page( uint8_t page )
+{
+  return page + 1 < kDisplayPages ? page + 1 : 0;
+}
+
+
+void display_calibrate( const DisplayPanel* panels, uint8_t count )
+{
+  for( uint8_t bus = 0; bus < kI2CBusCount; bus++ )
+  {
+    uint8_t addresses[8];     // the IS31FL3731 only has four addresses anyway
+    uint8_t on_bus = 0;
+    for( uint8_t i = 0; i < count && on_bus < sizeof( addresses ); i++ )
+    {
+      if( panels[i].bus == bus )
+        addresses[on_bus++] = panels[i].address;
+    }
+
+    if( on_bus )
+      i2c_calibrate( bus, addresses, on_bus );
+  }
+}
+
+// EOF
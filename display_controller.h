@@ -0,0 +1,103 @@
+//
+//  display_controller.h
+//
+//  Raw IS31FL3731 access.  The full Adafruit library is NOT used, writes go straight to the
+//  matrix driver to leave room for animation data (see the FirePendant project).
+//
+//  Every call takes the bus the controller hangs off (see i2c_clock.h) as well as its address.
+//
+//  Frames go through a queue kept in the controllers' own frame pages: the render writes each
+//  new frame into the next free page as soon as it has one, and a presenter released at the
+//  frame rate does nothing but point the Picture register at the oldest waiting page.  A slow
+//  frame eats into the queue instead of showing up as a stutter.
+//
+
+#ifndef display_controller_h
+#define display_controller_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+#include "brightness.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kDisplayPages      = 7;     // frame pages we initialise and queue frames in, the last one is left for calibration
+static const uint8_t  kDisplayQueueMax   = kDisplayPages - 1;   // one page is always on show
+static const uint8_t  kDisplayQueueDefault = 3;   // frames the render may get ahead, each is another frame of lag on the tilt
+
+enum
+{
+  kIS31_CommandRegister   = 0xFD,
+  kIS31_FunctionPage      = 0x0B,
+
+  // function page
+  kIS31_ConfigRegister    = 0x00,
+  kIS31_PictureRegister   = 0x01,
+  kIS31_ShutdownRegister  = 0x0A,
+  kIS31_FunctionRegisters = 13,
+
+  // frame pages
+  kIS31_LEDControl        = 0x00,     // 18 bytes, a bit per LED
+  kIS31_Blink             = 0x12,     // 18 bytes
+  kIS31_PWM               = 0x24,     // 144 bytes
+  kIS31_PageSize          = 0xB4,
+  kIS31_PWMBytes          = 144
+};
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint8_t  address;
+  uint8_t  bus;         // index for i2c_bus()
+  uint8_t  page;        // page on show
+  const uint16_t* map;  // PROGMEM render buffer index per PWM register, see panel_map.h
+  const uint8_t*  curve;  // PROGMEM gamma curve for this panel, see brightness.h
+  uint8_t  stale;       // a bit per page that missed part of its frame, the panel skips it
+#ifdef BRIGHTNESS_RAM_LUT
+  uint16_t lut_level;   // brightness lut was built for, starts at 0 which matches the zeroed lut
+  uint8_t  lut[kBrightnessLUTSize];   // curve with the global brightness folded in
+#endif
+} DisplayPanel;
+
+
+typedef struct
+{
+  uint8_t  head;        // oldest waiting page, presented next
+  uint8_t  tail;        // page the next frame goes into
+  uint8_t  depth;       // frames waiting
+  uint8_t  target;      // how far ahead of the presenter the render may get
+  uint32_t presented;
+  uint32_t underruns;   // presents that found nothing waiting, the last frame stayed up for another period
+} DisplayQueue;
+
+
+// Public API -----------------------------------------------------------------
+
+bool     display_setup( uint8_t bus, uint8_t address, uint8_t* page );    // returns true when the controller was still set up (warm restart)
+bool     display_is_configured( uint8_t bus, uint8_t address );
+bool     display_shutdown( uint8_t bus, uint8_t address, bool shutdown );  // software shutdown, the pages are kept
+
+void     writeRegister( uint8_t bus, uint8_t address, uint8_t n );
+bool     pageSelect( uint8_t bus, uint8_t address, uint8_t n );
+bool     display_write( uint8_t bus, uint8_t address, uint8_t reg, const uint8_t* data, uint16_t count );
+bool     display_read( uint8_t bus, uint8_t address, uint8_t reg, uint8_t* data, uint8_t count );
+bool     display_write_mapped( const DisplayPanel* panel, uint8_t reg, const uint8_t* buff, uint16_t count );
+
+// whole installation, each panel gathers its pixels out of buff through its map, its curve and the brightness
+void     display_calibrate( const DisplayPanel* panels, uint8_t count );
+void     buffer_frames( DisplayPanel* panels, uint8_t count, const uint8_t* buff );   // into the next queued page, check display_queue_full() first
+bool     display_present( DisplayPanel* panels, uint8_t count );                     // show the oldest queued frame once a frame period, false on an underrun
+
+// frame queue
+void     display_queue_reset( const DisplayPanel* panels );     // empty, after setup or a sleep
+void     display_queue_set_target( uint8_t frames );            // 1..kDisplayQueueMax
+bool     display_queue_full();
+const DisplayQueue* display_queue();
+
+
+#endif // display_controller_h
+// EOF
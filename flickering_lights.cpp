@@ -7,24 +7,61 @@
 
 #include "flickering_lights.h"
 #include "arduino_utilities.h"
+#include "pixel_kernels.h"
+#include "brightness.h"
 
 
 // Defines -----------------------------------------------------------------
 
 //#define LED_FLICKER_PIN  LED_BUILTIN
 #define LED_FLICKER_PIN  9
-#define STACK_MAX        50
 
+#ifdef ARDUINO_SAMD_ZERO
+#define FLICKER_MAX_CHANNELS  64
+#else
+#define FLICKER_MAX_CHANNELS  8     // the Pro Trinket only has 2K of RAM
+#endif
+
+// scratch space for the current flicker function, cleared every time a new one starts
 typedef struct
 {
-    uint32_t step;
     uint32_t start_time;  
-    uint32_t param;  
-    uint32_t counter;
+    uint16_t step;
+    uint16_t param;  
+    uint8_t  counter;
 } FlickerState;
 
-// this is the flicker function, when it returns true it is done processing and the next function will execute if there's one
-typedef bool (*FlickerFunc)( FlickerState* state );
+typedef struct FlickerChannel FlickerChannel;
+
+// this is the flicker function, when it returns true it is done processing and the next function will execute
+typedef bool (*FlickerFunc)( FlickerChannel* channel );
+
+enum
+{
+    kFlickerSink_Pin = 0,       // PWM pin
+    kFlickerSink_Region         // rectangle of the charlieplex matrix
+};
+
+// where a channel's brightness ends up
+typedef struct
+{
+    uint8_t type;
+    uint8_t pin;
+    uint8_t x;
+    uint8_t y;
+    uint8_t width;
+    uint8_t height;
+} FlickerSink;
+
+// one independently flickering "bulb"
+struct FlickerChannel
+{
+    FlickerState state;
+    FlickerFunc  func;
+    uint32_t     seed;          // every channel has its own random stream
+    FlickerSink  sink;
+    uint8_t      level;         // last brightness written, regions get painted with this
+};
 
 // ------------------------------------------
 enum
@@ -55,7 +92,9 @@ enum
     kFlickerBurstMinIntensity        = 230,
     kFlickerBurstMaxIntensity        = 255,
 
-    kFlickerFlourescentMaxIntensity  = 220
+    kFlickerRampTimeMS               = 3000,      // 0 to 255 in steps of 5 took about this once a loop at ~60ms
+
+    kFlickerFlourescentMaxIntensity  = kFlickerMaxBrightness
 };
 
 
@@ -82,70 +121,114 @@ enum
     kFlickerMostlyMinIntensity  = 200,
     kFlickerMostlyMaxIntensity  = 220,
 
-    kFlickerMostlyFlickerCount  = 10
+    kFlickerMostlyFlickerCount  = 6         // flickers before moving on, about what 10 loops of flickering came to at ~60ms a loop
 };
 
 
 // Forward declares ------------------------------------------------------
 
-bool flicker_random( FlickerState* state );
-bool flicker_dropout( FlickerState* state );
-bool flicker_brownout( FlickerState* state );
-bool flicker_on( FlickerState* state );
-bool flicker_off( FlickerState* state );
-bool flicker_mostly_on( FlickerState* state );
-bool flicker_mostly_off( FlickerState* state );
-bool flicker_ramp_on( FlickerState* state );
-bool flicker_ramp_off( FlickerState* state );
-bool flicker_bad_wiring( FlickerState* state );
+bool flicker_random( FlickerChannel* channel );
+bool flicker_dropout( FlickerChannel* channel );
+bool flicker_brownout( FlickerChannel* channel );
+bool flicker_on( FlickerChannel* channel );
+bool flicker_off( FlickerChannel* channel );
+bool flicker_mostly_on( FlickerChannel* channel );
+bool flicker_mostly_off( FlickerChannel* channel );
+bool flicker_ramp_on( FlickerChannel* channel );
+bool flicker_ramp_off( FlickerChannel* channel );
+// where a ramp is from the time since it started, 0 up to 255 over kFlickerRampTimeMS and past 255 once
+// it is done - so the ramps last as long however often the lights are ticked
+void flicker_ramp_step( FlickerState* state )
+{
+    uint32_t current = millis();
+    if( !state->counter )
+    {
+        state->start_time = current;
+        state->counter    = 1;
+    }
+
+    uint32_t interval = current - state->start_time;
+    state->step = interval >= kFlickerRampTimeMS ? 256 : interval * 256 / kFlickerRampTimeMS;
+}
+
 
-void randomly_fill_stack();
+bool flicker_bad_wiring( FlickerChannel* channel );
 
-void        stack_push( FlickerFunc );
-FlickerFunc stack_pop();
-int32_t     stack_depth();
+int8_t      add_channel( const FlickerSink* sink );
+void        start_next_func( FlickerChannel* channel );
+void        flicker_ramp_step( FlickerState* state );
+
+uint32_t    channel_random( FlickerChannel* channel, uint32_t low, uint32_t high );
+void        channel_write( FlickerChannel* channel, uint8_t level );
+void        channel_dark( FlickerChannel* channel );
 
 
 // Constants and static data ---------------------------------------------
 
 static const uint16_t kFlashDelayMS = 100;
 
-static int32_t      s_counter       = 0;
-static bool         s_toggle_state  = false;
-static FlickerState s_flicker_state = {0};
-static FlickerFunc  s_flicker_func  = NULL;
-
-// this is the function stack
-static FlickerFunc  s_func_stack[STACK_MAX] = { NULL };
-static int32_t      s_func_stack_index      = 0;  
-
-// we use this to randomize the array
-static FlickerFunc  s_func_array[] = 
-{ 
-    flicker_random,
-    flicker_dropout,
-    flicker_brownout,
-    flicker_brownout,
-    flicker_on,         // we stack a bunch of these to increase the chances of the light staying on more often than flickering
-    flicker_on,
-    flicker_on,
-    flicker_on,
-    flicker_on,
-    flicker_on,
-    flicker_off,
-    flicker_off,
-    flicker_off,
-    flicker_mostly_on,
-    flicker_mostly_off,
-    flicker_ramp_on,
-    flicker_ramp_on,
-    flicker_ramp_on,
-    flicker_ramp_off,
-    flicker_bad_wiring,
-    flicker_bad_wiring
+static bool           s_toggle_state  = false;
+
+// channels are packed at the front so a tick only touches the ones in use
+static FlickerChannel s_channels[FLICKER_MAX_CHANNELS];
+static uint8_t        s_channel_count = 0;
+
+// Every effect has a weight, the odds of it being picked next are weight / kFlickerWeightTotal.
+// Picking uses Walker's alias method: roll an entry, then roll against its threshold and either
+// keep it or take its alias.  That's two random numbers and one flash read per pick, no RAM.
+//
+// The thresholds and aliases below come from running Vose's construction on the weights with every
+// bucket holding kFlickerWeightTotal.  If you change a weight, regenerate them -- the static_assert
+// underneath will complain until the table adds up again.
+typedef struct
+{
+    FlickerFunc func;
+    uint8_t     weight;
+    uint8_t     threshold;      // keep this entry when the roll is below this
+    uint8_t     alias;          // ...otherwise use this one
+} FlickerEffect;
+
+enum
+{
+    kFlickerEffectCount = 10,
+    kFlickerWeightTotal = 21
+};
+
+static constexpr FlickerEffect PROGMEM s_effects[kFlickerEffectCount] =
+{
+    // func                 weight  threshold  alias
+    { flicker_random,        1,     10,        3 },
+    { flicker_dropout,       1,     10,        3 },
+    { flicker_brownout,      2,     20,        3 },
+    { flicker_on,            6,     21,        3 },    // the light stays on more often than it flickers
+    { flicker_off,           3,     16,        3 },
+    { flicker_mostly_on,     1,     10,        3 },
+    { flicker_mostly_off,    1,     10,        4 },
+    { flicker_ramp_on,       3,     18,        4 },
+    { flicker_ramp_off,      1,     10,        7 },
+    { flicker_bad_wiring,    2,     20,        7 }
 };
 
-#define countof( a ) (sizeof( a ) / sizeof( a[0] ))
+// compile time checks on the alias table, every effect must end up with exactly weight * count of the total mass
+constexpr uint16_t effect_weight_sum( uint8_t i )
+{
+    return i == kFlickerEffectCount ? 0 : s_effects[i].weight + effect_weight_sum( i + 1 );
+}
+
+constexpr uint16_t effect_alias_mass( uint8_t target, uint8_t i )
+{
+    return i == kFlickerEffectCount ? 0 : (s_effects[i].alias == target ? kFlickerWeightTotal - s_effects[i].threshold : 0) + effect_alias_mass( target, i + 1 );
+}
+
+constexpr bool effect_table_valid( uint8_t i )
+{
+    return i == kFlickerEffectCount || (s_effects[i].threshold <= kFlickerWeightTotal &&
+                                        s_effects[i].threshold + effect_alias_mass( i, 0 ) == s_effects[i].weight * kFlickerEffectCount &&
+                                        effect_table_valid( i + 1 ));
+}
+
+static_assert( effect_weight_sum( 0 ) == kFlickerWeightTotal, "flicker effect weights don't add up to kFlickerWeightTotal" );
+static_assert( effect_table_valid( 0 ), "flicker alias table is out of date with the weights" );
 
 
 // Code -----------------------------------------------------------------
@@ -154,23 +237,62 @@ static FlickerFunc  s_func_array[] =
 
 void flickering_lights_setup()
 {
-    pinMode( LED_FLICKER_PIN, OUTPUT );
-
-    memset( &s_flicker_state, 0, sizeof( s_flicker_state ) );
-    randomly_fill_stack();
+    s_channel_count = 0;
+    flickering_lights_add_pin( LED_FLICKER_PIN );
 }
 
  
 void flickering_lights_tick()
 {
-    if( !s_flicker_func )
-        randomly_fill_stack();
-        
-    // just keep calling the routine over and over until it is done
-    if( s_flicker_func && s_flicker_func( &s_flicker_state ) )
+    // just keep calling each channel's routine over and over until it is done
+    FlickerChannel* end = &s_channels[s_channel_count];
+    for( FlickerChannel* channel = s_channels; channel < end; channel++ )
+    {
+        if( channel->func( channel ) )
+            start_next_func( channel );
+    }
+}
+
+
+int8_t flickering_lights_add_pin( uint8_t pin )
+{
+    FlickerSink sink = { kFlickerSink_Pin, pin, 0, 0, 0, 0 };
+    pinMode( pin, OUTPUT );
+    return add_channel( &sink );
+}
+
+
+int8_t flickering_lights_add_region( uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t frame_width, uint8_t frame_height )
+{
+    // draw() fills whatever is stored here with no bounds of its own, so a region is clipped to the frame
+    // once up front - anything hanging off the right edge would otherwise wrap into the next row
+    if( x >= frame_width || y >= frame_height || !width || !height )
+        return -1;
+
+    if( width > frame_width - x )
+        width = frame_width - x;
+    if( height > frame_height - y )
+        height = frame_height - y;
+
+    FlickerSink sink = { kFlickerSink_Region, 0, x, y, width, height };
+    return add_channel( &sink );
+}
+
+
+uint8_t flickering_lights_channel_count()
+{
+    return s_channel_count;
+}
+
+
+void flickering_lights_draw( uint8_t* buff, uint8_t stride )
+{
+    FlickerChannel* end = &s_channels[s_channel_count];
+    for( FlickerChannel* channel = s_channels; channel < end; channel++ )
     {
-        s_flicker_func = stack_pop();
-        memset( &s_flicker_state, 0, sizeof( s_flicker_state ) );   // clear this for next func
+        const FlickerSink* sink = &channel->sink;
+        if( sink->type == kFlickerSink_Region )
+            pixel_fill_rect( buff, stride, sink->x, sink->y, sink->width, sink->height, channel->level );
     }
 }
 
@@ -199,19 +321,20 @@ void toggle_led()
 #pragma mark -
 
 
-bool flicker_random( FlickerState* state )
+bool flicker_random( FlickerChannel* channel )
 {
-    if( coin_flip() )
-        analogWrite( LED_FLICKER_PIN, random( 0, 256 ) );   // flicker at different brightnesses like a real broken bulb    
+    if( channel_random( channel, 0, 2 ) )
+        channel_write( channel, channel_random( channel, 0, 256 ) );   // flicker at different brightnesses like a real broken bulb    
     else
-        digitalWrite( LED_FLICKER_PIN, LOW );
+        channel_dark( channel );
              
     return true;
 }
 
 
-bool flicker_dropout( FlickerState* state )
+bool flicker_dropout( FlickerChannel* channel )
 {
+    FlickerState* state = &channel->state;
     uint32_t current  = millis();
     uint32_t interval = current - state->start_time;    
     
@@ -219,7 +342,7 @@ bool flicker_dropout( FlickerState* state )
     if( state->step == kFlickerDropoutState_Start )
     {
         // turn on the light but not all the way!
-        analogWrite( LED_FLICKER_PIN, kFlickerFlourescentMaxIntensity );
+        channel_write( channel, kFlickerFlourescentMaxIntensity );
         state->start_time = current;   // take the time...
         state->step++;  // go to next step
         return false;   // we aren't done yet
@@ -243,7 +366,7 @@ bool flicker_dropout( FlickerState* state )
     
     if( state->step == kFlickerDropoutState_Flicker )
     {
-        flicker_random( NULL );
+        flicker_random( channel );
         if( interval >= kFlickerDropoutFlickerTimeMS )
             state->step++;
         return false;
@@ -251,9 +374,9 @@ bool flicker_dropout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_Dropout )
     {
-        digitalWrite( LED_FLICKER_PIN, LOW );
+        channel_dark( channel );
         state->start_time = current;    
-        state->param      = random( kFlickerDropoutBlipMinTimeMS, kFlickerDropoutBlipMaxTimeMS );    // when to blip (blip might not even happen as its value is also random)
+        state->param      = channel_random( channel, kFlickerDropoutBlipMinTimeMS, kFlickerDropoutBlipMaxTimeMS );    // when to blip (blip might not even happen as its value is also random)
         state->step++;
         return false;
     }
@@ -264,7 +387,7 @@ bool flicker_dropout( FlickerState* state )
         if( interval >= state->param )  // random wait time here
         {
             state->start_time = current;
-            state->param = random( kFlickerDropoutBlipMinDurationMS, kFlickerDropoutBlipMaxDurationMS );
+            state->param = channel_random( channel, kFlickerDropoutBlipMinDurationMS, kFlickerDropoutBlipMaxDurationMS );
             state->step++;
         }
         return false;
@@ -272,7 +395,7 @@ bool flicker_dropout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_DropoutBlip )
     {
-        flicker_random( NULL );
+        flicker_random( channel );
         if( interval >= state->param )  // random wait time again
         {
             state->start_time = current;
@@ -284,7 +407,7 @@ bool flicker_dropout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_DropoutDone )
     {
-        digitalWrite( LED_FLICKER_PIN, LOW );
+        channel_dark( channel );
         return interval > kFlickerDropoutDarkTimeMS;
     }
 
@@ -292,8 +415,9 @@ bool flicker_dropout( FlickerState* state )
 }
 
 
-bool flicker_brownout( FlickerState* state )
+bool flicker_brownout( FlickerChannel* channel )
 {
+    FlickerState* state = &channel->state;
     uint32_t current  = millis();
     uint32_t interval = current - state->start_time;    
     
@@ -301,7 +425,7 @@ bool flicker_brownout( FlickerState* state )
     if( state->step == kFlickerDropoutState_Start )
     {
         // turn on the light
-        analogWrite( LED_FLICKER_PIN, kFlickerFlourescentMaxIntensity );
+        channel_write( channel, kFlickerFlourescentMaxIntensity );
         state->start_time = current;   // take the time...
         state->step++;  // go to next step
         return false;   // we aren't done yet
@@ -325,7 +449,7 @@ bool flicker_brownout( FlickerState* state )
     
     if( state->step == kFlickerDropoutState_Flicker )
     {
-        flicker_random( NULL );
+        flicker_random( channel );
         if( interval >= kFlickerDropoutFlickerTimeMS )
             state->step++;
         return false;
@@ -333,9 +457,9 @@ bool flicker_brownout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_Dropout )
     {
-        analogWrite( LED_FLICKER_PIN, random( kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
         state->start_time = current;    
-        state->param      = random( kFlickerDropoutBlipMinTimeMS, kFlickerDropoutBlipMaxTimeMS );    // when to blip (blip might not even happen as its value is also random)
+        state->param      = channel_random( channel, kFlickerDropoutBlipMinTimeMS, kFlickerDropoutBlipMaxTimeMS );    // when to blip (blip might not even happen as its value is also random)
         state->step++;
         return false;
     }
@@ -346,7 +470,7 @@ bool flicker_brownout( FlickerState* state )
         if( interval >= state->param )  // random wait time here
         {
             state->start_time = current;
-            state->param = random( kFlickerDropoutBlipMinDurationMS, kFlickerDropoutBlipMaxDurationMS );
+            state->param = channel_random( channel, kFlickerDropoutBlipMinDurationMS, kFlickerDropoutBlipMaxDurationMS );
             state->step++;
         }
         return false;
@@ -354,7 +478,7 @@ bool flicker_brownout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_DropoutBlip )
     {
-        flicker_random( NULL );
+        flicker_random( channel );
         if( interval >= state->param )  // random wait time again
         {
             state->start_time = current;
@@ -366,7 +490,7 @@ bool flicker_brownout( FlickerState* state )
 
     if( state->step == kFlickerDropoutState_DropoutDone )
     {
-        analogWrite( LED_FLICKER_PIN, random( kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
         return interval > kFlickerDropoutDarkTimeMS;
     }
 
@@ -376,25 +500,26 @@ bool flicker_brownout( FlickerState* state )
 
 
 // these all ramp up like a real flourescent light !!@ - implement me!!@  
-bool flicker_on( FlickerState* state )
+bool flicker_on( FlickerChannel* channel )
 {
     // this should blink a number of times, then go super bright, then dim to "normal"
-    analogWrite( LED_FLICKER_PIN, random( kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
+    channel_write( channel, channel_random( channel, kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
     return true;
 }
 
 
 // these all ramp up like a real flourescent light !!@ - implement me!!@ 
-bool flicker_off( FlickerState* state )
+bool flicker_off( FlickerChannel* channel )
 {
     // this should just be a series of blinks, then off
-    analogWrite( LED_FLICKER_PIN, random( kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
+    channel_write( channel, channel_random( channel, kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
     return true;
 }
 
 
-bool flicker_mostly_on( FlickerState* state )
+bool flicker_mostly_on( FlickerChannel* channel )
 {
+    FlickerState* state = &channel->state;
     uint32_t current  = millis();
     uint32_t interval = current - state->start_time;    
 
@@ -402,7 +527,7 @@ bool flicker_mostly_on( FlickerState* state )
     if( state->step == kFlickerState_Start )
     {
         state->start_time = current;    
-        state->param      = random( kFlickerMostlyOnMinTimeMS, kFlickerMostlyOnMaxTimeMS );    // how long to wait till a flicker
+        state->param      = channel_random( channel, kFlickerMostlyOnMinTimeMS, kFlickerMostlyOnMaxTimeMS );    // how long to wait till a flicker
         state->step++;
         return false;
     }
@@ -417,7 +542,7 @@ bool flicker_mostly_on( FlickerState* state )
     if( state->step == kFlickerState_FlickerStart )
     {
         state->start_time = current;
-        state->param      = random( kFlickerMostlyMinDurationMS, kFlickerMostlyMaxDurationMS ); // how long is this flicker
+        state->param      = channel_random( channel, kFlickerMostlyMinDurationMS, kFlickerMostlyMaxDurationMS ); // how long is this flicker
         state->step++;
         return false;
     }
@@ -425,14 +550,15 @@ bool flicker_mostly_on( FlickerState* state )
     if( state->step == kFlickerState_Flicker )
     {
         // we want bright flickers, flicker_random produces alot of low flickers too which we don't want, it's all or nothing here
-        analogWrite( LED_FLICKER_PIN, random( kFlickerMostlyMinIntensity, kFlickerMostlyMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerMostlyMinIntensity, kFlickerMostlyMaxIntensity ) );
         if( interval >= state->param )
         {
-            digitalWrite( LED_FLICKER_PIN, LOW );
+            channel_dark( channel );
             state->step = 0; // restart the cycle a few times
+            return (++state->counter >= kFlickerMostlyFlickerCount);
         }
-        
-        return (++state->counter > kFlickerMostlyFlickerCount);
+
+        return false;
     }
 
     return true;
@@ -440,8 +566,9 @@ bool flicker_mostly_on( FlickerState* state )
 
 
 // !!@ refactor this- it's exactly the same as mostly_on but with different constants !!@
-bool flicker_mostly_off( FlickerState* state )
+bool flicker_mostly_off( FlickerChannel* channel )
 {
+    FlickerState* state = &channel->state;
     uint32_t current  = millis();
     uint32_t interval = current - state->start_time;    
 
@@ -449,7 +576,7 @@ bool flicker_mostly_off( FlickerState* state )
     if( state->step == kFlickerState_Start )
     {
         state->start_time = current;    
-        state->param      = random( kFlickerMostlyOffMinTimeMS, kFlickerMostlyOffMaxTimeMS );    // how long to wait till a flicker
+        state->param      = channel_random( channel, kFlickerMostlyOffMinTimeMS, kFlickerMostlyOffMaxTimeMS );    // how long to wait till a flicker
         state->step++;
         return false;
     }
@@ -464,7 +591,7 @@ bool flicker_mostly_off( FlickerState* state )
     if( state->step == kFlickerState_FlickerStart )
     {
         state->start_time = current;
-        state->param      = random( kFlickerMostlyMinDurationMS, kFlickerMostlyMaxDurationMS ); // how long is this flicker
+        state->param      = channel_random( channel, kFlickerMostlyMinDurationMS, kFlickerMostlyMaxDurationMS ); // how long is this flicker
         state->step++;
         return false;
     }
@@ -472,14 +599,15 @@ bool flicker_mostly_off( FlickerState* state )
     if( state->step == kFlickerState_Flicker )
     {
         // we want bright flickers, flicker_random produces alot of low flickers too which we don't want, it's all or nothing here
-        analogWrite( LED_FLICKER_PIN, random( kFlickerMostlyMinIntensity, kFlickerMostlyMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerMostlyMinIntensity, kFlickerMostlyMaxIntensity ) );
         if( interval >= state->param )
         {
-            digitalWrite( LED_FLICKER_PIN, LOW );
+            channel_dark( channel );
             state->step = 0; // restart the cycle a few times
+            return (++state->counter >= kFlickerMostlyFlickerCount);
         }
-        
-        return (++state->counter > kFlickerMostlyFlickerCount);
+
+        return false;
     }
 
     return true;
@@ -487,14 +615,15 @@ bool flicker_mostly_off( FlickerState* state )
 
 
 
-bool flicker_ramp_on( FlickerState* state )
+bool flicker_ramp_on( FlickerChannel* channel )
 {
-    analogWrite( LED_FLICKER_PIN, state->step );
-    state->step += 5;
-    
+    FlickerState* state = &channel->state;
+    flicker_ramp_step( state );
+    channel_write( channel, state->step );
+
     // brown-out flicker
     if( state->step > 220 )
-        analogWrite( LED_FLICKER_PIN, random( kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
 
     if( state->step > 255 )
     {
@@ -506,14 +635,15 @@ bool flicker_ramp_on( FlickerState* state )
 }
 
 
-bool flicker_ramp_off( FlickerState* state )
+bool flicker_ramp_off( FlickerChannel* channel )
 {
-    analogWrite( LED_FLICKER_PIN, 255 - state->step );
-    state->step += 5;
-    
+    FlickerState* state = &channel->state;
+    flicker_ramp_step( state );
+    channel_write( channel, 255 - state->step );
+
     // blast brightness right at end
     if( state->step > 220 )
-        analogWrite( LED_FLICKER_PIN, random( kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
+        channel_write( channel, channel_random( channel, kFlickerBurstMinIntensity, kFlickerBurstMaxIntensity ) );
 
     if( state->step > 255 )
     {
@@ -525,19 +655,20 @@ bool flicker_ramp_off( FlickerState* state )
 }
 
 
-bool flicker_bad_wiring( FlickerState* state )
+bool flicker_bad_wiring( FlickerChannel* channel )
 {
+    FlickerState* state = &channel->state;
     uint32_t current  = millis();
     uint32_t interval = current - state->start_time;    
 
     // randomly wiggle the amplitude
-    analogWrite( LED_FLICKER_PIN, random( kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
+    channel_write( channel, channel_random( channel, kFlickerBrownoutMinIntensity, kFlickerBrownoutMaxIntensity ) );
 
     // take a random amount of time to wait
     if( state->step == kFlickerState_Start )
     {
         state->start_time = current;    
-        state->param      = random( kFlickerMostlyOnMinTimeMS, kFlickerDropoutDarkTimeMS );    // how long wiggle the amplitude
+        state->param      = channel_random( channel, kFlickerMostlyOnMinTimeMS, kFlickerDropoutDarkTimeMS );    // how long wiggle the amplitude
         state->step++;
         return false;
     }
@@ -549,51 +680,66 @@ bool flicker_bad_wiring( FlickerState* state )
 
 #pragma mark -
 
-void randomly_fill_stack()
+// Channels -----------------------------------------------------------------
+
+int8_t add_channel( const FlickerSink* sink )
 {
-    // use array of all funcs, and randomly choose from it to fill the stack
-    for( int i = 0; i < STACK_MAX; i++ )
+    if( s_channel_count >= FLICKER_MAX_CHANNELS )
     {
-        int8_t index = random( 0, countof( s_func_array ) );
-        stack_push( s_func_array[index] );
+        Serial.println( "out of flicker channels!" );
+        return -1;
     }
-    
-    s_flicker_func = stack_pop();    
+
+    FlickerChannel* channel = &s_channels[s_channel_count];
+    memset( channel, 0, sizeof( FlickerChannel ) );
+    channel->sink = *sink;
+    channel->seed = random( 1, 0x7FFFFFFF );    // seed from the global stream, xorshift can't start at 0
+    start_next_func( channel );
+
+    return s_channel_count++;
 }
 
 
+void start_next_func( FlickerChannel* channel )
+{
+    // weighted pick straight out of flash
+    uint8_t index = channel_random( channel, 0, kFlickerEffectCount );
+    if( channel_random( channel, 0, kFlickerWeightTotal ) >= pgm_read_byte( &s_effects[index].threshold ) )
+        index = pgm_read_byte( &s_effects[index].alias );
 
-#pragma mark -
+    channel->func = (FlickerFunc)pgm_read_ptr( &s_effects[index].func );
+    memset( &channel->state, 0, sizeof( channel->state ) );   // clear this for next func
+}
 
-// State stack -----------------------------------------------------------------
 
-void stack_push( FlickerFunc func )
+uint32_t channel_random( FlickerChannel* channel, uint32_t low, uint32_t high )
 {
-    if( s_func_stack_index > STACK_MAX )
-    {
-        s_func_stack_index = STACK_MAX - 1;
-        Serial.println( "flicker stack overflow!" );
-        return;
-    }
-    s_func_stack[s_func_stack_index++] = func;
+    // xorshift32, cheap and good enough for flickering
+    uint32_t x = channel->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    channel->seed = x;
+
+    if( high <= low )
+        return low;
+    return low + x % (high - low);
 }
 
 
-FlickerFunc stack_pop()
+void channel_write( FlickerChannel* channel, uint8_t level )
 {
-    FlickerFunc func = s_func_stack[--s_func_stack_index];
-    if( s_func_stack_index < 0 )
-    {
-        s_func_stack_index = 0;
-        return NULL;
-    }
-    return func;
+    channel->level = level;
+    if( channel->sink.type == kFlickerSink_Pin )
+        analogWrite( channel->sink.pin, brightness_dim( level ) );     // regions are dimmed by the panel luts instead
 }
 
 
-int32_t stack_depth()
+void channel_dark( FlickerChannel* channel )
 {
-    return s_func_stack_index;
+    channel->level = 0;
+    if( channel->sink.type == kFlickerSink_Pin )
+        digitalWrite( channel->sink.pin, LOW );
 }
 
 // EOF
@@ -24,8 +24,18 @@ typedef enum
     kFlickering_type_flicker_ramp_off
 } flickering_type;
 
-void     flickering_lights_setup(); 
+void     flickering_lights_setup();               // starts with one channel on the flicker pin
 void     flickering_lights_tick();
+
+// each channel is an independent bulb, returns the channel index or -1 when they are all used up
+int8_t   flickering_lights_add_pin( uint8_t pin );
+
+// regions are clipped to the frame they will be drawn into, one entirely outside it gets -1
+int8_t   flickering_lights_add_region( uint8_t x, uint8_t y, uint8_t width, uint8_t height, uint8_t frame_width, uint8_t frame_height );
+uint8_t  flickering_lights_channel_count();
+
+// paint the matrix region channels into a render buffer that is stride pixels wide (at least the frame_width they were added with)
+void     flickering_lights_draw( uint8_t* buff, uint8_t stride );
 void     flash_led( uint8_t num_pulses = 1 );
 void     toggle_led();
 
@@ -0,0 +1,161 @@
+//
+//  gesture.cpp
+//
+
+#include "gesture.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kGestureInputShift    = 3;      // kGestureInputOneG down to kGestureOneG
+static const uint8_t  kGestureGravityShift  = 4;      // low pass time constants in samples, as powers of two: 160 ms
+static const uint8_t  kGestureEnergyShift   = 3;      // 80 ms
+static const uint8_t  kGestureCrossingShift = 5;      // 320 ms
+static const uint16_t kGestureCrossing      = 256;    // one crossing in s_crossings, big enough that the leak never stalls
+
+static_assert( kGestureInputOneG >> kGestureInputShift == kGestureOneG, "input scale is off" );
+
+
+// Constants and static data ---------------------------------------------
+
+static uint8_t        s_up_axis        = 1;
+static int8_t         s_up_sign        = 1;
+static bool           s_primed         = false;
+
+static int32_t        s_gravity[3];                 // low passed reading, << kGestureGravityShift
+static uint32_t       s_energy         = 0;         // low passed movement, << kGestureEnergyShift
+static int8_t         s_swing[3];                   // which side of the crossing band each axis was last seen on
+static uint16_t       s_crossings      = 0;         // leaky count, kGestureCrossing each
+
+static bool           s_shaking        = false;     // a shake fired, waiting for things to calm down
+static bool           s_inverted       = false;
+static uint16_t       s_inverted_samples = 0;
+static int8_t         s_tilt           = 0;         // -1 left, 1 right
+static uint16_t       s_tilt_samples   = 0;
+static uint16_t       s_quiet          = 0;         // samples left before another gesture counts
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void gesture_setup( uint8_t up_axis, int8_t up_sign )
+{
+  s_up_axis = up_axis;
+  s_up_sign = up_sign;
+  gesture_reset();
+}
+
+
+void gesture_reset()
+{
+  s_primed           = false;
+  s_energy           = 0;
+  s_crossings        = 0;
+  s_shaking          = false;
+  s_inverted         = false;
+  s_inverted_samples = 0;
+  s_tilt             = 0;
+  s_tilt_samples     = 0;
+  s_quiet            = kGestureRefractory;     // give the low passes time to settle
+  memset( s_swing, 0, sizeof( s_swing ) );
+}
+
+
+uint8_t gesture_sample( int16_t x, int16_t y, int16_t z )
+{
+  int16_t reading[3] = { (int16_t)(x >> kGestureInputShift), (int16_t)(y >> kGestureInputShift), (int16_t)(z >> kGestureInputShift) };
+
+  // start the gravity estimate where we are, or the first samples would look like a violent jolt
+  if( !s_primed )
+  {
+    for( uint8_t i = 0; i < 3; i++ )
+      s_gravity[i] = (int32_t)reading[i] << kGestureGravityShift;
+    s_primed = true;
+  }
+
+  // gravity is what's left after the low pass, movement is the rest
+  uint16_t movement = 0;
+  int16_t  gravity[3];
+  for( uint8_t i = 0; i < 3; i++ )
+  {
+    s_gravity[i] += reading[i] - (s_gravity[i] >> kGestureGravityShift);
+    gravity[i]    = s_gravity[i] >> kGestureGravityShift;
+
+    int16_t moved = reading[i] - gravity[i];
+    movement += moved < 0 ? -moved : moved;
+
+    // a crossing only counts once the movement has swung clear of the band on the other side
+    int8_t side = moved > kGestureCrossingBand ? 1 : (moved < -kGestureCrossingBand ? -1 : 0);
+    if( side && side != s_swing[i] )
+    {
+      if( s_swing[i] )
+        s_crossings += kGestureCrossing;
+      s_swing[i] = side;
+    }
+  }
+
+  s_energy     = s_energy - (s_energy >> kGestureEnergyShift) + movement;
+  s_crossings -= s_crossings >> kGestureCrossingShift;
+
+  uint16_t energy  = s_energy >> kGestureEnergyShift;
+  bool     still   = energy < kGestureStillEnergy;
+  uint8_t  gesture = kGesture_None;
+
+  // shake: lots of movement going back and forth, fires once and then waits for it to die down
+  if( s_shaking )
+    s_shaking = !still;
+  else if( energy > kGestureShakeEnergy && s_crossings > kGestureShakeCrossings * kGestureCrossing )
+  {
+    s_shaking = true;
+    gesture   = kGesture_Shake;
+  }
+
+  // flip: over and back again, quickly - the wide hysteresis band keeps lying on its side from counting
+  int16_t up = gravity[s_up_axis] * s_up_sign;
+  if( !s_inverted && up < -kGestureUpsideDown )
+  {
+    s_inverted         = true;
+    s_inverted_samples = 0;
+  }
+  else if( s_inverted )
+  {
+    if( s_inverted_samples <= kGestureFlipMaxSamples )
+      s_inverted_samples++;
+
+    if( up > kGestureUpsideDown )
+    {
+      s_inverted = false;
+      if( s_inverted_samples <= kGestureFlipMaxSamples && !s_shaking )
+        gesture = kGesture_Flip;
+    }
+  }
+
+  // tilt-hold: leaned well over to one side and held there, upright and steady
+  int16_t across = gravity[0];
+  if( across > -kGestureTiltOff && across < kGestureTiltOff )
+    s_tilt = 0;
+  else if( !s_tilt && (across > kGestureTiltOn || across < -kGestureTiltOn) )
+  {
+    s_tilt         = across > 0 ? 1 : -1;
+    s_tilt_samples = 0;
+  }
+
+  if( s_tilt && still && !s_inverted && s_tilt_samples <= kGestureTiltHoldSamples )
+  {
+    if( ++s_tilt_samples == kGestureTiltHoldSamples )
+      gesture = s_tilt > 0 ? kGesture_TiltRight : kGesture_TiltLeft;
+  }
+
+  if( s_quiet )
+  {
+    --s_quiet;
+    return kGesture_None;
+  }
+
+  if( gesture )
+    s_quiet = kGestureRefractory;
+  return gesture;
+}
+
+// EOF
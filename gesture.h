@@ -0,0 +1,61 @@
+//
+//  gesture.h
+//
+//  Picks shake, flip and tilt-hold gestures out of the accelerometer stream so the jar can change
+//  modes without a reflash.  Every sample costs the same handful of integer operations: a low pass
+//  for gravity, whatever is left over as movement energy, zero crossings of that movement counted
+//  through hysteresis, and orientation states that need a clear margin before they change.  No
+//  history is kept, so it is the same few dozen bytes of RAM on the Pro Trinket.
+//
+//  Samples are in the render buffer's axes (see panel_remap_accel()) and LIS3DH counts at +-4 g,
+//  so the sketch hands over the raw reading and nothing touches floating point.
+//
+
+#ifndef gesture_h
+#define gesture_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Defines -----------------------------------------------------------------
+
+static const int16_t  kGestureInputOneG     = 8192;   // LIS3DH at +-4 g, left justified, what Adafruit_LIS3DH leaves in x, y and z
+
+// everything below is in 1/1024 g after the input is scaled down, and samples at the accelerometer's 100 Hz
+static const int16_t  kGestureOneG          = 1024;
+static const int16_t  kGestureShakeEnergy   = 700;    // mean movement while shaking, gravity removed
+static const uint8_t  kGestureShakeCrossings = 3;     // back and forths in the last third of a second or so
+static const int16_t  kGestureCrossingBand  = 300;    // movement has to swing past this either side to count as a crossing
+static const int16_t  kGestureStillEnergy   = 120;    // below this we trust the gravity estimate for orientation
+static const int16_t  kGestureUpsideDown    = 600;    // gravity this far the wrong way along the up axis, and this far back again to be upright
+static const uint16_t kGestureFlipMaxSamples = 300;   // upside down for longer than this was putting it down, not a flip
+static const int16_t  kGestureTiltOn        = 700;    // about 45 degrees, well past how far the dots are usually played with
+static const int16_t  kGestureTiltOff       = 400;
+static const uint16_t kGestureTiltHoldSamples = 150;  // a second and a half
+static const uint16_t kGestureRefractory    = 100;    // a second after any gesture before the next one counts
+
+enum
+{
+  kGesture_None = 0,
+  kGesture_Shake,
+  kGesture_Flip,              // turned upside down and back again
+  kGesture_TiltLeft,          // held over to one side
+  kGesture_TiltRight,
+
+  kGestureCount // please leave last
+};
+
+
+// Public API -----------------------------------------------------------------
+
+// the axis (0..2 for x, y, z) an upright jar reads +1 g along and that reading's sign, see panel_accel_up()
+void     gesture_setup( uint8_t up_axis, int8_t up_sign );
+void     gesture_reset();                          // forget the stream, after a sleep say
+
+// one reading, returns the gesture it completed or kGesture_None
+uint8_t  gesture_sample( int16_t x, int16_t y, int16_t z );
+
+
+#endif // gesture_h
+// EOF
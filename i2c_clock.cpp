@@ -0,0 +1,447 @@
+//
+//  i2c_clock.cpp
+//
+
+#include <Wire.h>
+#ifdef SECOND_I2C_BUS
+#include "wiring_private.h"    // pinPeripheral()
+#endif
+
+#include "i2c_clock.h"
+#include "display_controller.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint16_t kI2CReadMax        = kI2CWireBuffer;
+static const uint16_t kI2CWriteMax       = kI2CWireBuffer - 1;    // one byte goes to the register address, as in display_write()
+
+static const uint8_t  kI2CVerifyPasses   = 3;       // a rate has to survive this many round trips
+static const uint8_t  kI2CFallbackStreak = 3;       // failed uploads in a row before we slow down
+
+static const uint8_t  kI2CTimedOut       = 5;       // what endTransmission() returns when Wire's own timeout fires
+static const uint8_t  kI2CRecoveryClocks = 9;       // a byte and its ack, the most a stuck slave can still owe us
+static const uint8_t  kI2CRecoveryHalfUS = 5;       // 100 kHz while bit banging, every device copes with that
+
+
+// Constants and static data ---------------------------------------------
+
+// candidate rates, slowest first
+static const uint32_t PROGMEM s_rates[] = { 400000, 600000, 800000, 1000000 };
+static const uint8_t  kI2CRateCount = sizeof( s_rates ) / sizeof( s_rates[0] );
+
+static uint32_t       s_clock[kI2CBusCount];
+static uint8_t        s_rate_index[kI2CBusCount];       // index of the calibrated rate
+static uint32_t       s_upload_us[kI2CBusCount];
+static uint8_t        s_error_streak[kI2CBusCount];
+static I2CFaults      s_faults[kI2CBusCount];
+static uint32_t       s_budget_start[kI2CBusCount];
+static uint32_t       s_budget_us[kI2CBusCount];
+
+#ifdef SECOND_I2C_BUS
+TwoWire               Wire1( &sercom1, kI2CBus1SDA, kI2CBus1SCL );
+
+void SERCOM1_Handler()
+{
+  Wire1.onService();
+}
+#endif
+
+
+// Private API -----------------------------------------------------------------
+
+bool     rate_supported( uint32_t hz );
+bool     verify_display( uint8_t bus, uint8_t address, uint8_t seed );
+uint8_t  verify_pattern( uint8_t i, uint8_t seed );
+uint32_t time_upload( uint8_t bus, uint8_t address );
+void     bus_begin( uint8_t bus );
+#ifdef ARDUINO_SAMD_ZERO
+Sercom*  bus_sercom( uint8_t bus );
+#endif
+uint8_t  sda_pin( uint8_t bus );
+uint8_t  scl_pin( uint8_t bus );
+void     line_low( uint8_t pin );
+void     line_release( uint8_t pin );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void i2c_begin()
+{
+  for( uint8_t bus = 0; bus < kI2CBusCount; bus++ )
+  {
+    bus_begin( bus );
+    i2c_set_clock( bus, kI2CDefaultClock );
+  }
+}
+
+
+TwoWire* i2c_bus( uint8_t bus )
+{
+#ifdef SECOND_I2C_BUS
+  if( bus )
+    return &Wire1;
+#endif
+  return &Wire;
+}
+
+
+void i2c_set_clock( uint8_t bus, uint32_t hz )
+{
+#ifdef ARDUINO_SAMD_ZERO
+  i2c_bus( bus )->setClock( hz );
+#else  
+  // The TWSR/TWBR lines are AVR-specific and won't work on other MCUs.
+  TWSR = 0;                                // I2C prescaler = 1
+  TWBR = (F_CPU / hz - 16) / 2;
+#endif  // ARDUINO_SAMD_ZERO
+  s_clock[bus] = hz;
+}
+
+
+void i2c_use_clock( uint8_t bus, uint32_t hz )
+{
+  if( hz != s_clock[bus] )
+    i2c_set_clock( bus, hz );
+}
+
+
+uint32_t i2c_clock( uint8_t bus )
+{
+  return s_clock[bus];
+}
+
+
+uint32_t i2c_calibrated_clock( uint8_t bus )
+{
+  return pgm_read_dword( &s_rates[s_rate_index[bus]] );
+}
+
+
+uint32_t i2c_upload_time_us( uint8_t bus )
+{
+  return s_upload_us[bus];
+}
+
+
+#pragma mark -
+
+uint32_t i2c_calibrate( uint8_t bus, const uint8_t* addresses, uint8_t count )
+{
+  // walk up the rates and stop at the first one any display chokes on, faster won't be better
+  s_rate_index[bus] = 0;
+  for( uint8_t r = 0; r < kI2CRateCount; r++ )
+  {
+    uint32_t hz = pgm_read_dword( &s_rates[r] );
+    if( !rate_supported( hz ) )
+      break;
+
+    i2c_set_clock( bus, hz );
+
+    bool ok = true;
+    for( uint8_t pass = 0; ok && pass < kI2CVerifyPasses; pass++ )
+    {
+      for( uint8_t d = 0; ok && d < count; d++ )
+        ok = verify_display( bus, addresses[d], r * kI2CVerifyPasses + pass );
+    }
+
+    if( !ok )
+      break;
+    s_rate_index[bus] = r;
+  }
+
+  i2c_set_clock( bus, i2c_calibrated_clock( bus ) );
+  s_upload_us[bus]    = count ? time_upload( bus, addresses[0] ) : 0;
+  s_error_streak[bus] = 0;
+
+  Serial.print( "i2c bus " );
+  Serial.print( bus );
+  Serial.print( " clock (Hz): " );
+  Serial.print( s_clock[bus] );
+  Serial.print( ", upload (us): " );
+  Serial.println( s_upload_us[bus] );
+
+  return s_clock[bus];
+}
+
+
+void i2c_report_upload( uint8_t bus, bool ok )
+{
+  if( ok )
+  {
+    s_error_streak[bus] = 0;
+    return;
+  }
+
+  if( ++s_error_streak[bus] < kI2CFallbackStreak || s_rate_index[bus] == 0 )
+    return;
+
+  // the bus went bad on us, back off one notch (a recalibration may bring it back up later)
+  --s_rate_index[bus];
+  s_error_streak[bus] = 0;
+  i2c_set_clock( bus, i2c_calibrated_clock( bus ) );
+
+  Serial.print( "i2c bus " );
+  Serial.print( bus );
+  Serial.print( " errors, clock now (Hz): " );
+  Serial.println( s_clock[bus] );
+}
+
+
+#pragma mark -
+
+uint8_t i2c_end( uint8_t bus )
+{
+  uint32_t start   = micros();
+  uint8_t  result  = i2c_bus( bus )->endTransmission();
+  uint32_t elapsed = micros() - start;
+
+  // a slow transaction still got there, but it is counted: it means a device is stretching the clock on us
+  if( result == kI2CTimedOut || elapsed > kI2CTimeoutUS )
+    s_faults[bus].timeouts++;
+  else if( result )
+    s_faults[bus].errors++;
+  return result;
+}
+
+
+bool i2c_request( uint8_t bus, uint8_t address, uint8_t count )
+{
+  uint32_t start    = micros();
+  uint8_t  received = i2c_bus( bus )->requestFrom( address, count );
+
+  if( micros() - start > kI2CTimeoutUS )
+    s_faults[bus].timeouts++;
+  else if( received != count )
+    s_faults[bus].errors++;
+  return received == count;
+}
+
+
+bool i2c_retry( uint8_t bus )
+{
+  // a plain NACK leaves the bus idle and just needs another go, anything else gets clocked free first
+  if( i2c_over_budget( bus ) )
+    return false;
+
+  s_faults[bus].retries++;
+  return i2c_lines_idle( bus ) || i2c_recover( bus );
+}
+
+
+bool i2c_recover( uint8_t bus )
+{
+  uint32_t start = micros();
+  uint8_t  sda   = sda_pin( bus );
+  uint8_t  scl   = scl_pin( bus );
+
+  // take the pins off the peripheral and work them as open drain: pulled up, or driven low
+  i2c_bus( bus )->end();
+  line_release( sda );
+  line_release( scl );
+  delayMicroseconds( kI2CRecoveryHalfUS );
+
+  // a slave that lost track mid byte is holding SDA low waiting for clocks, give it them until it lets go
+  for( uint8_t i = 0; i < kI2CRecoveryClocks && !digitalRead( sda ); i++ )
+  {
+    line_low( scl );
+    delayMicroseconds( kI2CRecoveryHalfUS );
+    line_release( scl );
+    delayMicroseconds( kI2CRecoveryHalfUS );
+  }
+
+  // then a STOP (SDA rising while SCL is high) so every device is back to waiting for a START
+  line_low( sda );
+  delayMicroseconds( kI2CRecoveryHalfUS );
+  line_release( sda );
+  delayMicroseconds( kI2CRecoveryHalfUS );
+
+  bool idle = digitalRead( sda ) && digitalRead( scl );
+
+  bus_begin( bus );
+  i2c_set_clock( bus, s_clock[bus] );     // begin() puts the rate back to 100 kHz
+
+  s_faults[bus].recoveries++;
+  s_faults[bus].recovery_us += micros() - start;
+  return idle;
+}
+
+
+bool i2c_lines_idle( uint8_t bus )
+{
+  return digitalRead( sda_pin( bus ) ) && digitalRead( scl_pin( bus ) );
+}
+
+
+void i2c_set_budget( uint8_t bus, uint32_t us )
+{
+  s_budget_start[bus] = micros();
+  s_budget_us[bus]    = us;
+}
+
+
+bool i2c_over_budget( uint8_t bus )
+{
+  return s_budget_us[bus] && micros() - s_budget_start[bus] > s_budget_us[bus];
+}
+
+
+void i2c_count_skip( uint8_t bus )
+{
+  s_faults[bus].skipped++;
+}
+
+
+const I2CFaults* i2c_faults( uint8_t bus )
+{
+  return &s_faults[bus];
+}
+
+
+#pragma mark -
+
+void bus_begin( uint8_t bus )
+{
+  TwoWire* wire = i2c_bus( bus );
+  wire->begin();
+#ifdef SECOND_I2C_BUS
+  if( bus )
+  {
+    pinPeripheral( kI2CBus1SDA, PIO_SERCOM );    // after begin(), which hands the pins back to the port
+    pinPeripheral( kI2CBus1SCL, PIO_SERCOM );
+  }
+#endif
+
+#ifdef WIRE_HAS_TIMEOUT
+  // AVR Wire can give up on a hung transaction itself
+  wire->setWireTimeout( kI2CTimeoutUS, true );
+#endif
+
+#ifdef ARDUINO_SAMD_ZERO
+  // the stock SAMD Wire has no timeout and would wait forever on a slave holding SCL low, but its
+  // wait loops do give up on a bus error - so turn on the SERCOM's SCL low timeout, which raises one
+  // after 25-35 ms.  A held SDA loses the SERCOM arbitration straight away, and between uploads
+  // i2c_lines_idle() catches either line.  CTRLA can only be written with the SERCOM disabled, and
+  // begin() resets it, so this has to follow every begin()
+  Sercom* sercom = bus_sercom( bus );
+  sercom->I2CM.CTRLA.bit.ENABLE = 0;
+  while( sercom->I2CM.SYNCBUSY.bit.ENABLE );
+  sercom->I2CM.CTRLA.bit.LOWTOUTEN = 1;
+  sercom->I2CM.CTRLA.bit.ENABLE = 1;
+  while( sercom->I2CM.SYNCBUSY.bit.ENABLE );
+  sercom->I2CM.STATUS.bit.BUSSTATE = 1;     // idle again, which is where begin() left it
+  while( sercom->I2CM.SYNCBUSY.bit.SYSOP );
+
+  // the SERCOM mux leaves the pads' input buffers off, and digitalRead() needs them to watch the lines
+  PORT->Group[g_APinDescription[sda_pin( bus )].ulPort].PINCFG[g_APinDescription[sda_pin( bus )].ulPin].bit.INEN = 1;
+  PORT->Group[g_APinDescription[scl_pin( bus )].ulPort].PINCFG[g_APinDescription[scl_pin( bus )].ulPin].bit.INEN = 1;
+#endif
+}
+
+
+#ifdef ARDUINO_SAMD_ZERO
+Sercom* bus_sercom( uint8_t bus )
+{
+  return bus ? SERCOM1 : SERCOM3;     // the Feather M0 has Wire on SERCOM3, Wire1 is ours (see SECOND_I2C_BUS)
+}
+#endif
+
+
+uint8_t sda_pin( uint8_t bus )
+{
+  return bus ? kI2CBus1SDA : SDA;
+}
+
+
+uint8_t scl_pin( uint8_t bus )
+{
+  return bus ? kI2CBus1SCL : SCL;
+}
+
+
+void line_low( uint8_t pin )
+{
+  digitalWrite( pin, LOW );
+  pinMode( pin, OUTPUT );
+}
+
+
+void line_release( uint8_t pin )
+{
+  pinMode( pin, INPUT_PULLUP );
+}
+
+
+#pragma mark -
+
+bool rate_supported( uint32_t hz )
+{
+#ifdef ARDUINO_SAMD_ZERO
+  return hz <= 1000000;
+#else
+  // TWBR can't go below zero, so the fastest the AVR can do is F_CPU / 16 (750 kHz at 12 MHz)
+  return F_CPU / hz >= 16;
+#endif
+}
+
+
+// write a pattern to the scratch page and make sure every byte comes back.  It goes out and comes back
+// a Wire buffer at a time, with the pattern worked out again for each, so a whole page never has to sit
+// on the stack - the bursts are the same ones display_write() would send
+bool verify_display( uint8_t bus, uint8_t address, uint8_t seed )
+{
+  uint8_t chunk[kI2CReadMax];
+
+  pageSelect( bus, address, kI2CScratchPage );
+  for( uint8_t offset = 0; offset < kIS31_PWMBytes; )
+  {
+    uint8_t count = (kIS31_PWMBytes - offset) < kI2CWriteMax ? (kIS31_PWMBytes - offset) : kI2CWriteMax;
+    for( uint8_t i = 0; i < count; i++ )
+      chunk[i] = verify_pattern( offset + i, seed );
+    if( !display_write( bus, address, kIS31_PWM + offset, chunk, count ) )
+      return false;
+    offset += count;
+  }
+
+  for( uint8_t offset = 0; offset < kIS31_PWMBytes; )
+  {
+    uint8_t count = (kIS31_PWMBytes - offset) < kI2CReadMax ? (kIS31_PWMBytes - offset) : kI2CReadMax;
+    if( !display_read( bus, address, kIS31_PWM + offset, chunk, count ) )
+      return false;
+    for( uint8_t i = 0; i < count; i++ )
+    {
+      if( chunk[i] != verify_pattern( offset + i, seed ) )
+        return false;
+    }
+    offset += count;
+  }
+
+  return true;
+}
+
+
+uint8_t verify_pattern( uint8_t i, uint8_t seed )
+{
+  return (i * 37 + seed * 101) ^ (i >> 3);
+}
+
+
+// a blank page, in the same bursts as a frame's upload
+uint32_t time_upload( uint8_t bus, uint8_t address )
+{
+  uint8_t blank[kI2CWriteMax] = { 0 };
+
+  uint32_t start = micros();
+  pageSelect( bus, address, kI2CScratchPage );
+  for( uint8_t offset = 0; offset < kIS31_PWMBytes; )
+  {
+    uint8_t count = (kIS31_PWMBytes - offset) < kI2CWriteMax ? (kIS31_PWMBytes - offset) : kI2CWriteMax;
+    display_write( bus, address, kIS31_PWM + offset, blank, count );
+    offset += count;
+  }
+  return micros() - start;
+}
+
+// EOF
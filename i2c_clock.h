@@ -0,0 +1,104 @@
+//
+//  i2c_clock.h
+//
+//  I2C is most of our frame time, so instead of hardcoding 400 kHz we step the bus clock up
+//  towards the IS31FL3731's 1 MHz Fast-mode Plus limit and keep the fastest rate that reads
+//  back a scratch page correctly.  Errors at runtime step it back down again.
+//
+//  Each bus keeps its own clock, on the Feather M0 a second bus can be brought up on a spare
+//  SERCOM so each panel gets its own wires (see SECOND_I2C_BUS).  The buses are not driven at the
+//  same time: Wire blocks in endTransmission(), so the panels still go out one after the other and
+//  what a second bus buys is a slow panel no longer holding back the other's clock (see
+//  tools/host/two_buses.cpp).
+//
+//  Every transaction also has a time budget.  A device that glitches gets its bus recovered
+//  (SCL clocked until it lets go of SDA) and the transaction retried a couple of times, after
+//  that the caller gives up on the panel for a frame rather than hanging the frame loop.
+//
+
+#ifndef i2c_clock_h
+#define i2c_clock_h
+
+#include <stdio.h>
+#include <Arduino.h>
+#include <Wire.h>
+
+
+// Defines -----------------------------------------------------------------
+
+#ifdef ARDUINO_SAMD_ZERO
+//#define SECOND_I2C_BUS     // Wire1 on SERCOM1: SDA on pin 11, SCL on pin 13 (pullups needed)
+#endif
+
+#ifdef SECOND_I2C_BUS
+static const uint8_t  kI2CBusCount     = 2;
+#else
+static const uint8_t  kI2CBusCount     = 1;
+#endif
+
+// Wire's transmit/receive buffer, a write gets one byte less for the register address.  AVR Wire
+// says so in BUFFER_LENGTH (32 bytes), SAMD Wire doesn't say at all - its ring buffers have been
+// 64 bytes (older cores) and 256 (newer), so go with the smaller
+#if defined( WIRE_BUFFER_LENGTH )
+static const uint16_t kI2CWireBuffer   = WIRE_BUFFER_LENGTH;
+#elif defined( BUFFER_LENGTH )
+static const uint16_t kI2CWireBuffer   = BUFFER_LENGTH;
+#else
+static const uint16_t kI2CWireBuffer   = 64;
+#endif
+
+static const uint32_t kI2CDefaultClock = 400000;      // what we always used, and all the LIS3DH can do
+static const uint8_t  kI2CScratchPage  = 7;           // IS31FL3731 frame page we never show, the frame queue stops short of it
+
+static const uint8_t  kI2CBus1SDA      = 11;          // Wire1, see SECOND_I2C_BUS
+static const uint8_t  kI2CBus1SCL      = 13;
+
+static const uint32_t kI2CTimeoutUS    = 3000;        // about twice the longest burst at 400 kHz, anything slower is a fault
+static const uint8_t  kI2CRetries      = 2;           // per transaction, each after a bus recovery
+static const uint32_t kI2CFrameBudgetUS = 20000;      // an upload past this gives up on what it hasn't sent until next frame
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t errors;          // transactions that came back with an error
+  uint32_t timeouts;        // ...or that took longer than kI2CTimeoutUS
+  uint32_t retries;
+  uint32_t recoveries;      // times SCL was clocked to free the bus
+  uint32_t recovery_us;     // total time spent recovering
+  uint32_t skipped;         // panel uploads given up on for a frame
+} I2CFaults;
+
+
+// Public API -----------------------------------------------------------------
+
+void     i2c_begin();                               // starts every bus at kI2CDefaultClock
+TwoWire* i2c_bus( uint8_t bus );
+
+void     i2c_set_clock( uint8_t bus, uint32_t hz );
+void     i2c_use_clock( uint8_t bus, uint32_t hz );              // only touches the hardware when the rate actually changes
+uint32_t i2c_clock( uint8_t bus );
+
+// picks the fastest rate every display on the bus handles, logs it, and returns it
+uint32_t i2c_calibrate( uint8_t bus, const uint8_t* addresses, uint8_t count );
+uint32_t i2c_calibrated_clock( uint8_t bus );
+uint32_t i2c_upload_time_us( uint8_t bus );
+
+// call after every upload, a run of failures drops to the next slower rate
+void     i2c_report_upload( uint8_t bus, bool ok );
+
+// faults
+uint8_t  i2c_end( uint8_t bus );                    // endTransmission() with the time budget and counters, 0 when it went through
+bool     i2c_request( uint8_t bus, uint8_t address, uint8_t count );   // requestFrom() the same way, true when it all arrived
+bool     i2c_retry( uint8_t bus );                  // recover before another attempt, false when the bus didn't come back
+bool     i2c_recover( uint8_t bus );                // clock SCL until nothing holds SDA, then restart the bus
+bool     i2c_lines_idle( uint8_t bus );             // both lines high, nobody is holding the bus
+void     i2c_set_budget( uint8_t bus, uint32_t us );  // time from now the bus may spend on a frame, 0 for no limit
+bool     i2c_over_budget( uint8_t bus );            // no new transactions or retries once this is true
+void     i2c_count_skip( uint8_t bus );
+const I2CFaults* i2c_faults( uint8_t bus );
+
+
+#endif // i2c_clock_h
+// EOF
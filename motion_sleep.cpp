@@ -0,0 +1,375 @@
+//
+//  motion_sleep.cpp
+//
+
+#include <Wire.h>
+
+#include "motion_sleep.h"
+#include "i2c_clock.h"
+#include "profiler.h"
+
+#ifdef MOTION_SLEEP
+
+#ifdef ARDUINO_SAMD_ZERO
+#include <RTCZero.h>
+#else
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#endif
+
+
+// Defines -----------------------------------------------------------------
+
+// LIS3DH registers
+enum
+{
+  kLIS3DH_CtrlReg1      = 0x20,
+  kLIS3DH_CtrlReg2      = 0x21,
+  kLIS3DH_CtrlReg3      = 0x22,
+  kLIS3DH_CtrlReg5      = 0x24,
+  kLIS3DH_CtrlReg6      = 0x25,
+  kLIS3DH_Int1Cfg       = 0x30,
+  kLIS3DH_Int1Src       = 0x31,
+  kLIS3DH_Int1Ths       = 0x32,
+  kLIS3DH_Int1Duration  = 0x33,
+  kLIS3DH_ClickCfg      = 0x38,
+  kLIS3DH_ClickSrc      = 0x39,
+  kLIS3DH_ClickThs      = 0x3A,
+  kLIS3DH_TimeLimit     = 0x3B,
+  kLIS3DH_TimeLatency   = 0x3C,
+  kLIS3DH_TimeWindow    = 0x3D
+};
+
+static const uint8_t  kLIS3DH_SleepRate     = 0x4F;     // 50 Hz low power, still quick enough to catch a tap
+static const uint8_t  kLIS3DH_WakeThreshold = 3;        // 32 mg steps at +-4 g, high passed so gravity doesn't count
+static const uint8_t  kLIS3DH_TapThreshold  = 40;
+
+#ifndef ARDUINO_SAMD_ZERO
+static const uint16_t kWatchdogSleepMS      = 8000;     // longest watchdog period, the schedule counts these
+#endif
+
+
+// Constants and static data ---------------------------------------------
+
+static uint8_t        s_bus            = 0;
+static uint8_t        s_awake_rate     = 0;             // CTRL_REG1 the sketch set up, put back on wake
+
+static float          s_still_x        = 0;             // where we were when we last moved
+static float          s_still_y        = 0;
+static float          s_still_z        = 0;
+static uint32_t       s_moved_ms       = 0;
+static uint32_t       s_woke_ms        = 0;
+static uint16_t       s_fade           = 256;
+
+static uint32_t       s_asleep_seconds = 0;
+static uint16_t       s_wakes          = 0;
+static bool           s_timing_wake    = false;
+
+static volatile bool  s_motion         = false;
+
+#ifdef ARDUINO_SAMD_ZERO
+static RTCZero        s_rtc;
+#endif
+
+
+// Private API -----------------------------------------------------------------
+
+void     accel_write( uint8_t reg, uint8_t value );
+uint8_t  accel_read( uint8_t reg );
+void     arm_wake_interrupts();
+void     disarm_wake_interrupts();
+bool     schedule_dark();
+uint32_t sleep_until_wake( uint32_t max_seconds );
+void     motion_isr();
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void motion_sleep_setup( uint8_t bus )
+{
+  s_bus        = bus;
+  s_awake_rate = accel_read( kLIS3DH_CtrlReg1 );
+  s_moved_ms   = millis();
+  s_woke_ms    = s_moved_ms;
+
+  // the click and movement detectors only ever drive INT1, and only while we sleep
+  accel_write( kLIS3DH_CtrlReg3, 0 );
+  accel_write( kLIS3DH_CtrlReg6, 0x02 );                   // interrupts active low
+  accel_write( kLIS3DH_CtrlReg5, 0x08 );                   // latch INT1 until the source is read
+  accel_write( kLIS3DH_CtrlReg2, 0x01 );                   // high pass filter the movement detector
+  accel_write( kLIS3DH_Int1Ths, kLIS3DH_WakeThreshold );
+  accel_write( kLIS3DH_Int1Duration, 0 );
+  accel_write( kLIS3DH_ClickThs, 0x80 | kLIS3DH_TapThreshold );   // latched
+  accel_write( kLIS3DH_TimeLimit, 10 );
+  accel_write( kLIS3DH_TimeLatency, 20 );
+  accel_write( kLIS3DH_TimeWindow, 255 );
+
+  pinMode( kAccelIntPin, INPUT_PULLUP );
+
+#ifdef ARDUINO_SAMD_ZERO
+  s_rtc.begin();
+#endif
+}
+
+
+uint16_t motion_sleep_tick( float x, float y, float z )
+{
+  uint32_t now   = millis();
+  float    moved = fabsf( x - s_still_x ) + fabsf( y - s_still_y ) + fabsf( z - s_still_z );
+
+  if( moved > kSleepStillThreshold )
+  {
+    s_still_x  = x;
+    s_still_y  = y;
+    s_still_z  = z;
+    s_moved_ms = now;
+    if( !schedule_dark() )
+      s_fade = 256;           // picked up mid fade, come straight back
+    return s_fade;
+  }
+
+  if( now - s_moved_ms < kSleepStillSeconds * 1000UL && !schedule_dark() )
+    return s_fade;
+
+  uint16_t step = 256 / kSleepFadeFrames + 1;
+  s_fade = s_fade > step ? s_fade - step : 0;
+  return s_fade;
+}
+
+
+bool motion_sleep_due()
+{
+  return s_fade == 0;
+}
+
+
+void motion_sleep( const DisplayPanel* panels, uint8_t count )
+{
+  for( uint8_t i = 0; i < count; i++ )
+    display_shutdown( panels[i].bus, panels[i].address, true );
+
+  // the rest of the schedule cycle, or until something moves us
+  uint32_t max_seconds = 0;
+  if( schedule_dark() )
+    max_seconds = (kScheduleCycleMinutes - kScheduleOnMinutes) * 60UL;
+
+  arm_wake_interrupts();
+  uint32_t asleep = sleep_until_wake( max_seconds );
+  profiler_start( kProfile_Wake );
+  s_timing_wake = true;
+  disarm_wake_interrupts();
+
+  s_asleep_seconds += asleep;
+  ++s_wakes;
+
+  for( uint8_t i = 0; i < count; i++ )
+    display_shutdown( panels[i].bus, panels[i].address, false );
+
+  s_fade     = 256;
+  s_moved_ms = millis();
+  s_woke_ms  = s_moved_ms;
+
+  Serial.print( "woke after (s): " );
+  Serial.println( asleep );
+}
+
+
+void motion_sleep_frame_shown()
+{
+  if( !s_timing_wake )
+    return;
+
+  profiler_stop( kProfile_Wake );
+  s_timing_wake = false;
+}
+
+
+uint32_t motion_sleep_total_seconds()
+{
+  return s_asleep_seconds;
+}
+
+
+uint16_t motion_sleep_wake_count()
+{
+  return s_wakes;
+}
+
+
+#pragma mark -
+
+void accel_write( uint8_t reg, uint8_t value )
+{
+  TwoWire* wire = i2c_bus( s_bus );
+  wire->beginTransmission( kAccelAddress );
+  wire->write( reg );
+  wire->write( value );
+  i2c_end( s_bus );
+}
+
+
+uint8_t accel_read( uint8_t reg )
+{
+  TwoWire* wire = i2c_bus( s_bus );
+  wire->beginTransmission( kAccelAddress );
+  wire->write( reg );
+  if( i2c_end( s_bus ) != 0 || !i2c_request( s_bus, kAccelAddress, 1 ) )
+    return 0;
+  return wire->read();
+}
+
+
+void arm_wake_interrupts()
+{
+  i2c_use_clock( s_bus, kI2CDefaultClock );
+  accel_write( kLIS3DH_CtrlReg1, kLIS3DH_SleepRate );
+  accel_write( kLIS3DH_Int1Cfg, 0x2A );                    // OR of X, Y or Z high
+  accel_write( kLIS3DH_ClickCfg, 0x15 );                   // single tap on any axis
+  accel_write( kLIS3DH_CtrlReg3, 0xC0 );                   // click and movement on INT1
+  accel_read( kLIS3DH_Int1Src );                           // throw away anything latched while we were awake
+  accel_read( kLIS3DH_ClickSrc );
+}
+
+
+void disarm_wake_interrupts()
+{
+  accel_write( kLIS3DH_CtrlReg3, 0 );
+  accel_write( kLIS3DH_Int1Cfg, 0 );
+  accel_write( kLIS3DH_ClickCfg, 0 );
+  accel_read( kLIS3DH_Int1Src );
+  accel_read( kLIS3DH_ClickSrc );
+  accel_write( kLIS3DH_CtrlReg1, s_awake_rate );
+}
+
+
+bool schedule_dark()
+{
+  if( !kScheduleOnMinutes )
+    return false;
+  return millis() - s_woke_ms >= kScheduleOnMinutes * 60000UL;
+}
+
+
+// level triggered, so it keeps firing until the latch is cleared; it only has to wake us once
+void motion_isr()
+{
+  s_motion = true;
+  detachInterrupt( digitalPinToInterrupt( kAccelIntPin ) );
+}
+
+
+#pragma mark -
+
+#ifdef ARDUINO_SAMD_ZERO
+
+uint32_t sleep_until_wake( uint32_t max_seconds )
+{
+  s_motion = false;
+  attachInterrupt( digitalPinToInterrupt( kAccelIntPin ), motion_isr, LOW );
+
+  // the EIC normally runs from the main clock which stops in standby, move it to the RTC's 32 kHz clock.
+  // What it ran from is read back first (writing the ID byte alone selects which clock CLKCTRL reads)
+  // so it can go back on wake - left on 32 kHz, every other pin interrupt would be slow and filtered
+  *(volatile uint8_t*)&GCLK->CLKCTRL.reg = GCM_EIC;
+  while( GCLK->STATUS.bit.SYNCBUSY )
+    ;
+  uint16_t eic_clock = GCLK->CLKCTRL.reg;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2 | GCLK_CLKCTRL_ID( GCM_EIC );
+  while( GCLK->STATUS.bit.SYNCBUSY )
+    ;
+  EIC->WAKEUP.reg |= 1 << digitalPinToInterrupt( kAccelIntPin );
+
+  s_rtc.setEpoch( 0 );
+  if( max_seconds )
+  {
+    s_rtc.setAlarmEpoch( max_seconds );
+    s_rtc.enableAlarm( s_rtc.MATCH_YYMMDDHHMMSS );
+  }
+
+  USBDevice.detach();
+  SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;     // a pending tick would stop us going into standby
+  while( !s_motion && (!max_seconds || s_rtc.getEpoch() < max_seconds) )
+  {
+    // the flag is checked with interrupts off, or movement landing between the check and the WFI would
+    // be taken by motion_isr() (which detaches itself) and we'd sleep with nothing left to wake us.
+    // WFI still wakes on an interrupt that is pending while they are off, it runs once they're back on
+    __disable_irq();
+    if( !s_motion )
+      s_rtc.standbyMode();
+    __enable_irq();
+  }
+  SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+  USBDevice.attach();
+
+  s_rtc.disableAlarm();
+  detachInterrupt( digitalPinToInterrupt( kAccelIntPin ) );
+
+  GCLK->CLKCTRL.reg = eic_clock;
+  while( GCLK->STATUS.bit.SYNCBUSY )
+    ;
+  return s_rtc.getEpoch();
+}
+
+#else
+
+uint32_t sleep_until_wake( uint32_t max_seconds )
+{
+  uint32_t asleep_ms = 0;
+  uint8_t  adcsra    = ADCSRA;
+  uint8_t  wdtcsr    = WDTCSR;            // nothing else uses the watchdog since the scheduler took over frame pacing, it is put back anyway
+
+  s_motion = false;
+  ADCSRA   = 0;                           // the ADC draws a couple of hundred uA in power down otherwise
+
+  // the watchdog is only needed to count time for the schedule
+  noInterrupts();
+  MCUSR  &= ~_BV( WDRF );
+  WDTCSR  = _BV( WDCE ) | _BV( WDE );
+  WDTCSR  = max_seconds ? (_BV( WDIE ) | _BV( WDP3 ) | _BV( WDP0 )) : 0;    // ~8 s or off
+  interrupts();
+
+  attachInterrupt( digitalPinToInterrupt( kAccelIntPin ), motion_isr, LOW );
+  while( !s_motion && (!max_seconds || asleep_ms < max_seconds * 1000UL) )
+  {
+    // the flag is checked with interrupts off, or movement landing between the check and the sleep
+    // would be taken by motion_isr() (which detaches itself) and nothing would be left to wake us.
+    // The instruction after sei always runs first, so an interrupt pending by then still wakes the sleep
+    set_sleep_mode( SLEEP_MODE_PWR_DOWN );
+    noInterrupts();
+    if( !s_motion )
+    {
+      sleep_enable();
+      interrupts();
+      sleep_cpu();
+      sleep_disable();
+    }
+    interrupts();
+
+    if( !s_motion )
+      asleep_ms += kWatchdogSleepMS;
+  }
+  detachInterrupt( digitalPinToInterrupt( kAccelIntPin ) );
+
+  noInterrupts();
+  MCUSR  &= ~_BV( WDRF );
+  WDTCSR  = _BV( WDCE ) | _BV( WDE );
+  WDTCSR  = wdtcsr;
+  interrupts();
+
+  ADCSRA = adcsra;
+  return asleep_ms / 1000;
+}
+
+
+// Watchdog timer interrupt (does nothing, but required) - it only wakes us to count time for the dark schedule
+ISR( WDT_vect )
+{
+}
+
+#endif  // ARDUINO_SAMD_ZERO
+
+#endif  // MOTION_SLEEP
+
+// EOF
@@ -0,0 +1,66 @@
+//
+//  motion_sleep.h
+//
+//  Battery jars spend most of their life sitting on a shelf.  When the accelerometer has been
+//  still for a while (or the optional dark schedule says so) the dots fade out, the matrix
+//  drivers go into software shutdown, the LIS3DH drops to a low power rate with its movement
+//  and tap interrupts armed on INT1, and the MCU goes into its deepest sleep until one fires.
+//
+//  Wiring: LIS3DH INT1 to kAccelIntPin.  The interrupt is set up active low so the AVR can
+//  use a level interrupt, the only kind that wakes it from power down.
+//
+//  On the Feather M0 the timed part of the schedule uses the RTC (RTCZero library), and USB
+//  serial drops off the bus while asleep and comes back on wake.
+//
+//  Switched on here rather than in the sketch so motion_sleep.cpp sees it too, with it off none
+//  of this is built and RTCZero isn't needed.
+//
+
+#ifndef motion_sleep_h
+#define motion_sleep_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+#include "display_controller.h"
+
+
+// Defines -----------------------------------------------------------------
+
+//#define MOTION_SLEEP       // go dark when the jar sits still, needs LIS3DH INT1 wired up
+
+static const uint8_t  kAccelAddress         = 0x18;
+#ifdef ARDUINO_SAMD_ZERO
+static const uint8_t  kAccelIntPin          = 6;
+#else
+static const uint8_t  kAccelIntPin          = 3;        // INT1 on the Pro Trinket
+#endif
+
+static const uint16_t kSleepStillSeconds    = 60;       // no movement for this long and we go dark
+static const float    kSleepStillThreshold  = 0.8f;     // m/s^2 summed over the three axes, anything more counts as movement
+static const uint8_t  kSleepFadeFrames      = 48;
+
+// optional dark schedule, like a candle timer: lit for kScheduleOnMinutes out of every
+// kScheduleCycleMinutes (0 turns it off).  The cycle restarts whenever movement wakes us.
+static const uint16_t kScheduleOnMinutes    = 0;
+static const uint16_t kScheduleCycleMinutes = 24 * 60;
+
+
+// Public API -----------------------------------------------------------------
+
+void     motion_sleep_setup( uint8_t bus );                     // after the accelerometer is started
+
+// once per frame with the latest reading, returns the fade factor for pixel_scale() (256 = fully lit)
+uint16_t motion_sleep_tick( float x, float y, float z );
+bool     motion_sleep_due();                                    // the fade has finished
+
+// shuts the panels down, sleeps until movement, a tap or the schedule wakes us, then brings them back
+void     motion_sleep( const DisplayPanel* panels, uint8_t count );
+void     motion_sleep_frame_shown();                            // call after each frame is presented, ends the wake latency timer
+
+uint32_t motion_sleep_total_seconds();
+uint16_t motion_sleep_wake_count();
+
+
+#endif // motion_sleep_h
+// EOF
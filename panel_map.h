@@ -0,0 +1,191 @@
+//
+//  panel_map.h
+//
+//  Where each IS31FL3731 register gets its pixel from.  A panel's layout - how its LEDs are
+//  wired to the registers, where it tiles into the render buffer, and how it is turned or
+//  flipped on the mount - is boiled down at compile time into one PROGMEM table of render
+//  buffer indices, register order.  The upload gathers through it as it feeds Wire, so
+//  remapping costs nothing over a straight copy.
+//
+//  The same rotation and mirroring turns accelerometer readings into render buffer directions.
+//
+
+#ifndef panel_map_h
+#define panel_map_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+#include "display_controller.h"
+#include "static_table.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint16_t kPanelUnmapped = 0xFFFF;      // register with no LED behind it, written as 0
+
+// how far the panel is turned clockwise on the mount
+enum
+{
+  kPanelRotate_0 = 0,
+  kPanelRotate_90,
+  kPanelRotate_180,
+  kPanelRotate_270
+};
+
+// applied in the panel's own coordinates before it is rotated
+enum
+{
+  kPanelMirror_None = 0,
+  kPanelMirror_X    = 0x01,
+  kPanelMirror_Y    = 0x02
+};
+
+// which way the accelerometer board sits
+enum
+{
+  kAccelMount_Standing = 0,     // production jars, Y is up
+  kAccelMount_Flat              // our dev board, Z is up
+};
+
+
+// Wiring -----------------------------------------------------------------
+//
+// register -> LED position on the panel, and whether there is an LED there at all
+
+// Adafruit 16x9 CharliePlex matrix (2947 etc) on the driver breakout: row major, one to one
+struct Matrix16x9Wiring
+{
+  static const uint8_t kWidth  = 16;
+  static const uint8_t kHeight = 9;
+
+  static constexpr bool    lit( uint16_t reg )    { return reg < kWidth * kHeight; }
+  static constexpr uint8_t led_x( uint16_t reg )  { return reg % 16; }
+  static constexpr uint8_t led_y( uint16_t reg )  { return reg / 16; }
+};
+
+// Adafruit 15x7 CharliePlex FeatherWing, the inverse of Adafruit_CharlieWing::drawPixel()
+struct CharlieWingWiring
+{
+  static const uint8_t kWidth  = 15;
+  static const uint8_t kHeight = 7;
+
+  static constexpr uint8_t col( uint16_t reg )    { return reg % 16; }
+  static constexpr uint8_t row( uint16_t reg )    { return reg / 16; }
+
+  static constexpr bool    lit( uint16_t reg )    { return col( reg ) >= 8 ? (row( reg ) >= 1 && row( reg ) <= 7 && col( reg ) <= 14) : (row( reg ) <= 7 && col( reg ) >= 1); }
+  static constexpr uint8_t led_x( uint16_t reg )  { return col( reg ) >= 8 ? 15 - row( reg ) : row( reg ); }
+  static constexpr uint8_t led_y( uint16_t reg )  { return col( reg ) >= 8 ? col( reg ) - 8 : 7 - col( reg ); }
+};
+
+
+// Layout -----------------------------------------------------------------
+
+template< class Wiring, uint8_t Stride, uint8_t TileX, uint8_t TileY, uint8_t Rotation = kPanelRotate_0, uint8_t Mirror = kPanelMirror_None >
+struct PanelLayout
+{
+  typedef uint16_t value_type;
+
+  static const uint16_t kCount      = kIS31_PWMBytes;
+  static const uint8_t  kRotation   = Rotation;
+  static const uint8_t  kMirror     = Mirror;
+  static const uint8_t  kTileWidth  = (Rotation & 1) ? Wiring::kHeight : Wiring::kWidth;    // footprint in the render buffer
+  static const uint8_t  kTileHeight = (Rotation & 1) ? Wiring::kWidth : Wiring::kHeight;
+
+  static constexpr uint8_t panel_x( uint16_t reg )
+  {
+    return (Mirror & kPanelMirror_X) ? Wiring::kWidth - 1 - Wiring::led_x( reg ) : Wiring::led_x( reg );
+  }
+
+  static constexpr uint8_t panel_y( uint16_t reg )
+  {
+    return (Mirror & kPanelMirror_Y) ? Wiring::kHeight - 1 - Wiring::led_y( reg ) : Wiring::led_y( reg );
+  }
+
+  static constexpr uint8_t tile_x( uint16_t reg )
+  {
+    return Rotation == kPanelRotate_90  ? Wiring::kHeight - 1 - panel_y( reg ) :
+           Rotation == kPanelRotate_180 ? Wiring::kWidth - 1 - panel_x( reg ) :
+           Rotation == kPanelRotate_270 ? panel_y( reg ) : panel_x( reg );
+  }
+
+  static constexpr uint8_t tile_y( uint16_t reg )
+  {
+    return Rotation == kPanelRotate_90  ? panel_x( reg ) :
+           Rotation == kPanelRotate_180 ? Wiring::kHeight - 1 - panel_y( reg ) :
+           Rotation == kPanelRotate_270 ? Wiring::kWidth - 1 - panel_x( reg ) : panel_y( reg );
+  }
+
+  // render buffer index for a register
+  static constexpr uint16_t value( uint16_t reg )
+  {
+    return Wiring::lit( reg ) ? (TileY + tile_y( reg )) * Stride + TileX + tile_x( reg ) : kPanelUnmapped;
+  }
+
+  static const uint16_t* table()     { return StaticTable< PanelLayout >::table; }
+};
+
+
+// for a static_assert next to the layout, every index has to land inside the render buffer
+template< class Layout >
+constexpr bool panel_layout_fits( uint16_t buffer_size, uint16_t reg = 0 )
+{
+  return reg >= Layout::kCount ||
+         ((Layout::value( reg ) == kPanelUnmapped || Layout::value( reg ) < buffer_size) && panel_layout_fits< Layout >( buffer_size, reg + 1 ));
+}
+
+
+// Accelerometer -----------------------------------------------------------------
+
+// sensor axes to render buffer axes, for a panel mounted with the given rotation and mirroring.
+// Works on m/s^2 from getEvent() or on the raw counts alike.
+template< class T >
+inline void panel_remap_accel( uint8_t mount, uint8_t rotation, uint8_t mirror, T sx, T sy, T sz, T* x, T* y, T* z )
+{
+  T px, py;
+  if( mount == kAccelMount_Flat )
+  {
+    px = sy;
+    py = sx;
+    *z = sz;
+  }
+  else
+  {
+    px = sz;
+    py = -sy;
+    *z = sx;
+  }
+
+  if( mirror & kPanelMirror_X )
+    px = -px;
+  if( mirror & kPanelMirror_Y )
+    py = -py;
+
+  switch( rotation )
+  {
+    case kPanelRotate_90:   *x = -py;  *y = px;   break;
+    case kPanelRotate_180:  *x = -px;  *y = -py;  break;
+    case kPanelRotate_270:  *x = py;   *y = -px;  break;
+    default:                *x = px;   *y = py;   break;
+  }
+}
+
+
+// which render axis an upright jar's gravity reading lies along, and its sign there.  The LIS3DH
+// reads +1 g on whichever of its axes points up, so this is that axis through the remap above -
+// on the standing mount that is -y, the render buffer's y runs down the panel.
+inline void panel_accel_up( uint8_t mount, uint8_t rotation, uint8_t mirror, uint8_t* axis, int8_t* sign )
+{
+  int8_t up[3];
+  if( mount == kAccelMount_Flat )
+    panel_remap_accel< int8_t >( mount, rotation, mirror, 0, 0, 1, &up[0], &up[1], &up[2] );
+  else
+    panel_remap_accel< int8_t >( mount, rotation, mirror, 0, 1, 0, &up[0], &up[1], &up[2] );
+
+  *axis = up[0] ? 0 : (up[1] ? 1 : 2);
+  *sign = up[*axis];
+}
+
+
+#endif // panel_map_h
+// EOF
@@ -0,0 +1,196 @@
+//
+//  pixel_kernels.h
+//
+//  Word packed (SWAR) operations on 8 bit render buffers.  Four pixels travel in one
+//  32-bit register, which is the widest thing the Cortex-M0 can chew on in a single op.
+//  Buffers handed to these must be 4 byte aligned (see kPixelAlign).
+//
+
+#ifndef pixel_kernels_h
+#define pixel_kernels_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Defines -----------------------------------------------------------------
+
+#define kPixelAlign  __attribute__(( aligned( 4 ) ))
+
+// lets us walk a uint8_t buffer a word at a time without upsetting the optimizer
+typedef uint32_t __attribute__(( __may_alias__ )) pixel_word_t;
+
+static const uint32_t kPixelLanesLo = 0x00FF00FF;
+static const uint32_t kPixelLaneMSB = 0x80808080;
+static const uint32_t kPixelLaneLSB = 0x01010101;
+
+
+// Lane operations -----------------------------------------------------------------
+
+// scale each of the four bytes by factor/256 (factor is 0..256)
+inline uint32_t swar_scale( uint32_t w, uint16_t factor )
+{
+    // split into even and odd bytes so every product has 16 bits of room
+    uint32_t even = (((w & kPixelLanesLo) * factor) >> 8) & kPixelLanesLo;
+    uint32_t odd  = (((w >> 8) & kPixelLanesLo) * factor) & ~kPixelLanesLo;
+    return even | odd;
+}
+
+
+// turn the top bit of each byte into a 0x00 or 0xFF byte mask
+inline uint32_t swar_lane_mask( uint32_t msb )
+{
+    return (msb >> 7) * 0xFF;
+}
+
+
+// per byte a + b, clamped at 255
+inline uint32_t swar_add_sat( uint32_t a, uint32_t b )
+{
+    // add the low 7 bits so nothing carries between lanes, then patch the top bits back in
+    uint32_t sum   = ((a & ~kPixelLaneMSB) + (b & ~kPixelLaneMSB)) ^ ((a ^ b) & kPixelLaneMSB);
+    uint32_t carry = ((a & b) | ((a | b) & ~sum)) & kPixelLaneMSB;
+    return sum | swar_lane_mask( carry );
+}
+
+
+// per byte max( a, b )
+inline uint32_t swar_max( uint32_t a, uint32_t b )
+{
+    // top bit of each lane of t is set when the low 7 bits of a >= those of b
+    uint32_t t  = (a | kPixelLaneMSB) - (b & ~kPixelLaneMSB);
+    uint32_t ge = ((a & ~b) | (~(a ^ b) & t)) & kPixelLaneMSB;
+    uint32_t m  = swar_lane_mask( ge );
+    return (a & m) | (b & ~m);
+}
+
+
+// Buffer operations -----------------------------------------------------------------
+//
+// count is in pixels, it is normally a multiple of 4 but any stragglers are done a byte at a time
+
+// multiply every pixel by factor/256 (256 leaves the buffer alone), this is global dimming
+inline void pixel_scale( uint8_t* buff, uint16_t count, uint16_t factor )
+{
+    pixel_word_t* w   = (pixel_word_t*)buff;
+    pixel_word_t* end = w + (count >> 2);
+
+    while( w < end )
+    {
+        *w = swar_scale( *w, factor );
+        ++w;
+    }
+
+    for( uint16_t i = count & ~3; i < count; i++ )
+        buff[i] = (buff[i] * factor) >> 8;
+}
+
+
+// fade the last frame, factors below 256 are guaranteed to head towards black
+inline void pixel_decay( uint8_t* buff, uint16_t count, uint16_t factor )
+{
+    pixel_scale( buff, count, factor > 255 ? 255 : factor );
+}
+
+
+// per frame factor that halves brightness every half_life frames
+inline uint16_t pixel_decay_factor( uint16_t half_life )
+{
+    if( !half_life )
+        return 0;
+
+    // always strictly less than 256 otherwise dim pixels would never make it to zero
+    uint16_t factor = (uint16_t)(256.0f * powf( 0.5f, 1.0f / half_life ) + 0.5f);
+    return factor > 255 ? 255 : factor;
+}
+
+
+// dst += src, clamped at full brightness
+inline void pixel_add_sat( uint8_t* dst, const uint8_t* src, uint16_t count )
+{
+    pixel_word_t*       d = (pixel_word_t*)dst;
+    const pixel_word_t* s = (const pixel_word_t*)src;
+
+    for( uint16_t i = count >> 2; i; i--, d++, s++ )
+        *d = swar_add_sat( *d, *s );
+
+    for( uint16_t i = count & ~3; i < count; i++ )
+        dst[i] = dst[i] + src[i] > 255 ? 255 : dst[i] + src[i];
+}
+
+
+// dst = max( dst, src ), the lighten blend
+inline void pixel_max( uint8_t* dst, const uint8_t* src, uint16_t count )
+{
+    pixel_word_t*       d = (pixel_word_t*)dst;
+    const pixel_word_t* s = (const pixel_word_t*)src;
+
+    for( uint16_t i = count >> 2; i; i--, d++, s++ )
+        *d = swar_max( *d, *s );
+
+    for( uint16_t i = count & ~3; i < count; i++ )
+        if( src[i] > dst[i] )
+            dst[i] = src[i];
+}
+
+
+inline void pixel_fill( uint8_t* buff, uint16_t count, uint8_t value )
+{
+    pixel_word_t* w    = (pixel_word_t*)buff;
+    uint32_t      word = value * kPixelLaneLSB;
+
+    for( uint16_t i = count >> 2; i; i-- )
+        *w++ = word;
+
+    for( uint16_t i = count & ~3; i < count; i++ )
+        buff[i] = value;
+}
+
+
+// fill a rectangle in a buffer that is stride pixels wide (stride must be a multiple of 4)
+inline void pixel_fill_rect( uint8_t* buff, uint8_t stride, uint8_t x, uint8_t y, uint8_t w, uint8_t h, uint8_t value )
+{
+    uint32_t word = value * kPixelLaneLSB;
+    uint8_t  head = (4 - (x & 3)) & 3;            // bytes until the first whole word
+    if( head > w )
+        head = w;
+    uint8_t  words = (w - head) >> 2;
+    uint8_t  tail  = (w - head) & 3;
+
+    for( uint8_t* row = &buff[y * stride + x]; h; h--, row += stride )
+    {
+        uint8_t* p = row;
+        for( uint8_t i = 0; i < head; i++ )
+            *p++ = value;
+
+        pixel_word_t* wp = (pixel_word_t*)p;
+        for( uint8_t i = 0; i < words; i++ )
+            *wp++ = word;
+
+        p = (uint8_t*)wp;
+        for( uint8_t i = 0; i < tail; i++ )
+            *p++ = value;
+    }
+}
+
+
+inline void pixel_clear_rect( uint8_t* buff, uint8_t stride, uint8_t x, uint8_t y, uint8_t w, uint8_t h )
+{
+    pixel_fill_rect( buff, stride, x, y, w, h, 0 );
+}
+
+
+// Field operations -----------------------------------------------------------------
+//
+// 16 bit accumulation buffers, for looks where overlapping contributions have to add up past 255
+
+// field[i] += weights[i] * intensity / 256 along a row, weights are PROGMEM (one row of a falloff kernel)
+inline void field_accumulate_span( uint16_t* field, const uint8_t* weights, uint8_t count, uint8_t intensity )
+{
+    for( ; count; count--, field++, weights++ )
+        *field += (pgm_read_byte( weights ) * intensity) >> 8;
+}
+
+
+#endif // pixel_kernels_h
+// EOF
@@ -0,0 +1,51 @@
+//
+//  profiler.cpp
+//
+
+#include "profiler.h"
+
+
+// Constants and static data ---------------------------------------------
+
+static uint32_t       s_start_us[kProfileCount];
+static ProfileCounter s_counters[kProfileCount];
+
+
+// Code -----------------------------------------------------------------
+
+void profiler_reset()
+{
+    memset( s_counters, 0, sizeof( s_counters ) );
+}
+
+
+void profiler_start( uint8_t stage )
+{
+    s_start_us[stage] = micros();
+}
+
+
+void profiler_stop( uint8_t stage )
+{
+    profiler_record( stage, micros() - s_start_us[stage] );
+}
+
+
+void profiler_record( uint8_t stage, uint32_t elapsed )
+{
+    ProfileCounter* counter = &s_counters[stage];
+
+    counter->last_us   = elapsed;
+    counter->total_us += elapsed;
+    counter->count++;
+    if( elapsed > counter->max_us )
+        counter->max_us = elapsed;
+}
+
+
+const ProfileCounter* profiler_counter( uint8_t stage )
+{
+    return &s_counters[stage];
+}
+
+// EOF
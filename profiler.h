@@ -0,0 +1,52 @@
+//
+//  profiler.h
+//
+//  Tiny micros() based stage timer.  Each stage keeps its last, worst and running total
+//  so we can see where a frame goes without sprinkling Serial.prints through loop().
+//
+
+#ifndef profiler_h
+#define profiler_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Data types -----------------------------------------------------------------
+
+enum
+{
+  kProfile_Flicker,
+  kProfile_Accel,
+  kProfile_Render,
+  kProfile_Upload,
+  kProfile_Frame,       // render and upload of the same frame added up, not the wait between the two tasks
+  kProfile_Boot,        // reset to first frame on show
+  kProfile_Wake,        // motion sleep wake up to first frame on show
+  kProfile_Idle,        // time the scheduler spent asleep waiting for the next task
+  kProfile_Present,     // pointing the panels at the next queued frame
+
+  kProfileCount // please leave last
+};
+
+
+typedef struct
+{
+  uint32_t last_us;
+  uint32_t max_us;
+  uint32_t total_us;
+  uint32_t count;
+} ProfileCounter;
+
+
+// Public API -----------------------------------------------------------------
+
+void                  profiler_reset();
+void                  profiler_start( uint8_t stage );
+void                  profiler_stop( uint8_t stage );
+void                  profiler_record( uint8_t stage, uint32_t elapsed_us );    // for a stage timed in pieces
+const ProfileCounter* profiler_counter( uint8_t stage );
+
+
+#endif // profiler_h
+// EOF
@@ -21,8 +21,6 @@ static const int8_t   kDeviceWidth    = 16;
 static const int8_t   kDeviceHeight   = 9;
 
 static const uint32_t kFrameDelayMS   = 0;
-static const uint8_t  kMaxBrightness  = 220;
-static const uint8_t  kOverBrightness = 255;
 
 static const uint32_t kNumSteps       = 600;
 static const int8_t   kMaxWidth       = 16;
@@ -37,6 +35,15 @@ static const int8_t   kMaxHeight         = kDeviceHeight;
 
 static const uint8_t  kNumDots           = kMaxDots;
 
+static const uint16_t kTrailHalfLife     = 8;    // frames, used by the decay (persistence) erase mode
+
+// the metaball mode needs a 16 bit field the size of the render buffer, more than the Pro Trinket can spare
+#ifndef __AVR__
+#define DOTS_METABALLS
+#endif
+
+static const uint8_t  kMetaballCount     = 12;   // how many of the dots become metaballs, a few big ones merge best
+
 // Data types -----------------------------------------------------------------
 
 enum
@@ -54,6 +61,30 @@ enum
 };
 
 
+// how the frame buffer is prepared before each frame is drawn
+enum
+{
+  kEraseMode_None = 0,  // draw on top of the last frame
+  kEraseMode_Clear,     // start from black every frame
+  kEraseMode_Decay      // fade the last frame so dots leave trails
+};
+
+
+// the different looks, switchable at runtime
+enum
+{
+  kDotsMode_BlobAccel = 0,
+  kDotsMode_Cloud,
+  kDotsMode_Disappearing,
+  kDotsMode_DisappearingAccel,
+  kDotsMode_Blob,
+  kDotsMode_AllOnLow,    // for debugging
+  kDotsMode_Metaball,    // dots as soft blobs that merge, draws kDotsMode_Blob without DOTS_METABALLS
+
+  kDotsModeCount // please leave last
+};
+
+
 typedef struct
 {
   uint8_t  x;
@@ -68,7 +99,14 @@ typedef struct
 
 void     pulsing_dots_setup(); 
 uint8_t* pulsing_dots_get_render_buffer();
-void     pulsing_dots_draw( float accel_x, float accel_y, float accel_z, bool erase );
+void     pulsing_dots_draw( float accel_x, float accel_y, float accel_z, uint8_t erase_mode );
+void     pulsing_dots_set_trail_half_life( uint16_t frames );
+
+void     pulsing_dots_set_mode( uint8_t mode );
+uint8_t  pulsing_dots_get_mode();
+void     pulsing_dots_set_max_brightness( uint8_t brightness );
+void     pulsing_dots_set_num_steps( uint32_t num_steps );
+void     pulsing_dots_set_metaball_count( uint8_t count );
 
  
 #endif // pulsing_dots_h
@@ -0,0 +1,614 @@
+//
+//  pulsing_dots_renderer.h
+//
+//  The pulsing dots engine as a template over panel geometry, dot count and pixel format.
+//  Everything that used to be a runtime bounds check against kMaxWidth/kMaxHeight is now
+//  a compile time constant, so several panel layouts can live in one binary.
+//
+//  All state, including the random stream, lives in the instance, so any number of them can run
+//  side by side (tools/host builds whole installations of jars this way).
+//
+
+#ifndef pulsing_dots_renderer_h
+#define pulsing_dots_renderer_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+#include "pulsing_dots.h"
+#include "pixel_kernels.h"
+#include "static_table.h"
+#include "brightness.h"
+
+
+// Defines -----------------------------------------------------------------
+
+#define roundFloat( v ) (uint32_t)(v + 0.5f)
+
+//#define ALLOW_DOTS_TO_DISAPPEAR   // makes it so that the dark spots caused by shifting aren't filled in randomly
+//#define RANDOM_DURATION           // makes it more shimmery by allowing the number of steps in pulsing to be random
+//#define DUMP_PULSE
+
+static const uint8_t  kMinDotSteps    = 3;
+
+
+// Metaballs -----------------------------------------------------------------
+//
+// every metaball adds a radial falloff scaled by its pulse into a 16 bit field, which is then
+// shaded through a soft threshold so neighbouring balls melt into each other
+
+static const uint8_t  kMetaballRadius    = 3;     // pixels, the bounding box is twice this plus one
+static const uint16_t kMetaballThreshold = 64;    // field value where the surface starts to show
+static const uint16_t kMetaballFull      = 192;   // field value that shades to full intensity
+static const uint16_t kMetaballGain      = (255 << 8) / (kMetaballFull - kMetaballThreshold);   // no divide on the M0
+
+// the falloff over a ball's whole bounding box, row by row: 255 * (1 - d^2/reach)^2
+struct MetaballFalloff
+{
+  typedef uint8_t value_type;
+
+  static const uint8_t  kSpan  = 2 * kMetaballRadius + 1;
+  static const uint16_t kCount = kSpan * kSpan;
+  static const uint16_t kReach = kMetaballRadius * kMetaballRadius + kMetaballRadius + 1;   // squared distance it reaches zero at
+
+  static constexpr int16_t  offset( uint16_t i )    { return (int16_t)i - kMetaballRadius; }
+  static constexpr uint16_t distance2( uint16_t i ) { return offset( i % kSpan ) * offset( i % kSpan ) + offset( i / kSpan ) * offset( i / kSpan ); }
+  static constexpr uint8_t  value( uint16_t i )
+  {
+    return distance2( i ) >= kReach ? 0 : 255UL * (kReach - distance2( i )) * (kReach - distance2( i )) / (kReach * kReach);
+  }
+};
+
+
+// Pixel formats -----------------------------------------------------------------
+
+// gamma corrected PWM values, for drivers that take the buffer as is
+struct GammaPixel
+{
+    static inline uint8_t encode( uint8_t intensity ) { return pgm_read_byte( &PanelGamma::table()[intensity] ); }
+};
+
+// straight intensity, the panels correct it per panel as it is uploaded (or debugging)
+struct LinearPixel
+{
+    static inline uint8_t encode( uint8_t intensity ) { return intensity; }
+};
+
+
+// Renderer -----------------------------------------------------------------
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel = LinearPixel >
+class PulsingDotsRenderer
+{
+public:
+    static const uint8_t  kWidth      = Width;
+    static const uint8_t  kHeight     = Height;
+    static const uint8_t  kDots       = Dots;
+    static const uint16_t kBufferSize = (uint16_t)Width * Height;
+
+    void     setup( uint32_t seed );                 // seed must not be zero
+    uint8_t* get_render_buffer()  { return m_buffer; }
+    void     draw( float x, float y, float z, uint8_t erase_mode );
+    void     set_trail_half_life( uint16_t frames )  { m_decay_factor = pixel_decay_factor( frames ); }
+
+    // live tuning
+    void     set_mode( uint8_t mode )                { if( mode < kDotsModeCount ) m_mode = mode; }
+    uint8_t  get_mode() const                        { return m_mode; }
+    void     set_max_brightness( uint8_t brightness );
+    void     set_num_steps( uint32_t num_steps );
+    void     set_metaball_count( uint8_t count )     { m_metaballs = count < 1 ? 1 : (count > Dots ? Dots : count); }
+
+    // the different looks, draw() picks one of these
+    void     cloud( uint8_t* buff );
+    void     blob( uint8_t* buff );
+    void     disappearing( uint8_t* buff );
+    void     disappearing_accel( uint8_t* buff, float x, float y, float z );
+    void     blob_accel( uint8_t* buff, float x, float y, float z );
+    void     all_on_low( uint8_t* buff );
+#ifdef DOTS_METABALLS
+    void     metaball( uint8_t* buff );
+#endif
+
+    void     draw_pixel( uint8_t* buff, uint8_t x, uint8_t y, uint8_t intensity );
+    void     draw_dot( uint8_t* buff, uint8_t x, uint8_t y, uint8_t intensity );
+
+private:
+    inline void put( uint8_t* p, uint8_t value );
+    inline void plot( uint8_t* buff, uint8_t x, uint8_t y, uint8_t value );
+
+    uint8_t  pulse_intensity( PulseState* state );
+    void     draw_pulse( uint8_t* buff, PulseState* state );
+    void     move_dot_using_accel( PulseState* state, float x, float y, float z );
+    void     move_dot_randomly( PulseState* state );
+    uint32_t rand_range( uint32_t low, uint32_t high );
+
+    uint32_t   m_seed;            // every instance has its own random stream
+    uint8_t    m_frame;
+    uint8_t    m_mode;
+    uint8_t    m_max_brightness;
+    uint32_t   m_num_steps;
+    bool       m_accumulate;      // true when the decayed previous frame is still in the buffer
+    uint16_t   m_decay_factor;
+    uint8_t    m_metaballs;
+    PulseState m_dot[Dots];
+    uint8_t    m_buffer[kBufferSize] kPixelAlign;
+#ifdef DOTS_METABALLS
+    uint16_t   m_field[kBufferSize];
+#endif
+};
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+inline void PulsingDotsRenderer<Width, Height, Dots, Pixel>::put( uint8_t* p, uint8_t value )
+{
+  // when the old frame is still around keep the brighter of the two so trails build up under the dots
+  if( !m_accumulate || value > *p )
+    *p = value;
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+inline void PulsingDotsRenderer<Width, Height, Dots, Pixel>::plot( uint8_t* buff, uint8_t x, uint8_t y, uint8_t value )
+{
+  // don't draw outside buffer - the coordinates are unsigned so x - 1 off the left edge wraps to 255 and fails here too
+  if( x >= Width || y >= Height )
+    return;
+
+  // simply index into the buffer
+  put( &buff[y * Width + x], value );
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+uint32_t PulsingDotsRenderer<Width, Height, Dots, Pixel>::rand_range( uint32_t low, uint32_t high )
+{
+  // xorshift32, same as the flicker channels
+  uint32_t x = m_seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  m_seed = x;
+
+  if( high <= low )
+    return low;
+  return low + x % (high - low);
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::draw_pixel( uint8_t* buff, uint8_t x, uint8_t y, uint8_t intensity )
+{
+  plot( buff, x, y, Pixel::encode( intensity ) );
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::draw_dot( uint8_t* buff, uint8_t x, uint8_t y, uint8_t intensity )
+{
+  // we draw a pixel at full intensity and four around it, like a star (or pixelated circle)
+  uint8_t full = Pixel::encode( intensity );
+  uint8_t half = Pixel::encode( intensity / 2 );
+
+  // when the whole star is inside the buffer (almost always) stamp it without any clipping
+  if( (uint8_t)(x - 1) < Width - 2 && (uint8_t)(y - 1) < Height - 2 )
+  {
+    uint8_t* center = &buff[y * Width + x];
+    put( &center[0], full );
+    put( &center[Width], half );
+    put( &center[-Width], half );
+    put( &center[1], half );
+    put( &center[-1], half );
+    return;
+  }
+
+  plot( buff, x, y, full );
+
+  // half intensity pixels
+  plot( buff, x, y + 1, half );
+  plot( buff, x, y - 1, half );
+  plot( buff, x + 1, y, half );
+  plot( buff, x - 1, y, half );
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+uint8_t PulsingDotsRenderer<Width, Height, Dots, Pixel>::pulse_intensity( PulseState* state )
+{
+    uint32_t half = roundFloat( state->num_steps * 0.5f );
+    uint8_t  intensity;
+
+#ifdef DUMP_PULSE
+    Serial.print( "draw_pulse: half: " );
+    Serial.print( half );
+    Serial.print( ", step: " );
+    Serial.print( state->step );
+#endif
+
+    // ramp up halfway and then ramp down
+    if( state->step < half )
+    {
+      uint32_t maxValue = state->step + 1;
+      intensity = state->max_brightness - roundFloat( state->max_brightness / maxValue );
+#ifdef DUMP_PULSE
+      Serial.print( ", up: " );
+      Serial.print( intensity );
+#endif
+    }
+    else
+    {
+      uint32_t i = (state->step - half);
+      uint32_t maxValue = i + 1;
+      intensity = i == 0 ? state->max_brightness : roundFloat( state->max_brightness / maxValue );
+#ifdef DUMP_PULSE
+      Serial.print( ", dn: " );
+      Serial.print( intensity );
+#endif
+    }
+
+    ++state->step;
+    if( state->step >= state->num_steps )
+      state->step = 0;
+
+#ifdef DUMP_PULSE
+    Serial.println();
+#endif
+    return intensity;
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::draw_pulse( uint8_t* buff, PulseState* state )
+{
+    draw_dot( buff, state->x, state->y, pulse_intensity( state ) );
+}
+
+#pragma mark -
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::move_dot_using_accel( PulseState* state, float x, float y, float z )
+{
+   // we use rounding to turn almost zero values to zero.  The scale is 0-9 or so...
+  state->x = roundFloat( x + state->x );    // what should we do with z coord?
+  state->y = roundFloat( y + state->y );
+
+#ifdef ALLOW_DOTS_TO_DISAPPEAR
+  // now make sure this dot still fits in the screen (eventually when we draw the dot ourselves we can let it clip)
+  if( state->x < 1 )
+    state->x = 1;
+  if( state->y < 1)
+    state->y = 1;
+
+  if( state->x >= Width )
+    state->x = Width - 1;
+  if( state->y >= Height )
+    state->y = Height - 1;
+#else
+  // if the dot disappeared, make it randomly appear again -- note: we should only
+  // allow the new dot to be in the invalidated area, not the entire display !!@
+  if( state->x < 1 || state->x > Width || state->y < 1 || state->y > Height )
+  {
+    state->x = rand_range( 0, Width );
+    state->y = rand_range( 0, Height );
+  }
+#endif
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::move_dot_randomly( PulseState* state )
+{
+  // pick a random direction and then move just one pixel that way
+  uint8_t randDirection = rand_range( 0, kDirectionCount );
+
+  switch( randDirection )
+  {
+      case kNorth:
+        ++state->y;
+        break;
+
+      case kNE:
+        ++state->y;
+        ++state->x;
+        break;
+
+      case kEast:
+        ++state->x;
+        break;
+
+      case kSE:
+        ++state->x;
+        --state->y;
+        break;
+
+      case kSouth:
+        --state->y;
+        break;
+
+      case kSW:
+        --state->y;
+        --state->x;
+        break;
+
+      case kWest:
+        --state->x;
+        break;
+
+      case kNW:
+        --state->x;
+        ++state->y;
+        break;
+  }
+
+  // now make sure this dot still fits in the screen (eventually when we draw the dot ourselves we can let it clip)
+  if( state->x < 1 )
+    state->x = 1;
+  if( state->y < 1)
+    state->y = 1;
+
+  if( state->x >= Width )
+    state->x = Width - 1;
+  if( state->y >= Height )
+    state->y = Height - 1;
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::cloud( uint8_t* buff )
+{
+    // this one is more cloud like
+    if( m_frame >= Dots )
+      m_frame = 0;
+
+    draw_pulse( buff, &m_dot[m_frame] );
+    move_dot_randomly( &m_dot[m_frame] );
+    ++m_frame;
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::blob( uint8_t* buff )
+{
+    // nice and blobby
+    for( int i = 0; i < Dots; i++ )
+    {
+      draw_pulse( buff, &m_dot[i] );
+      move_dot_randomly( &m_dot[i] );
+    }
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::disappearing( uint8_t* buff )
+{
+  for( int i = 0; i < Dots; i++ )
+  {
+    if( m_dot[i].step )
+      draw_pulse( buff, &m_dot[i] );
+    else
+    {
+        // find a new position while black
+        m_dot[i].x = rand_range( 0, Width );
+        m_dot[i].y = rand_range( 0, Height );
+    }
+  }
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::disappearing_accel( uint8_t* buff, float x, float y, float z )
+{
+  for( int i = 0; i < Dots; i++ )
+  {
+    if( m_dot[i].step )
+      draw_pulse( buff, &m_dot[i] );
+    else
+    {
+        // find a new position while black
+        move_dot_using_accel( &m_dot[i], x, y, z );
+    }
+  }
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::blob_accel( uint8_t* buff, float x, float y, float z )
+{
+    for( int i = 0; i < Dots; i++ )
+    {
+      draw_pulse( buff, &m_dot[i] );
+      if( m_dot[i].step != 0 )
+      {
+        move_dot_using_accel( &m_dot[i], x, y, z );
+      }
+      else
+      {
+        // find a new position while black
+        m_dot[i].x = rand_range( 0, Width );
+        m_dot[i].y = rand_range( 0, Height );
+      }
+    }
+}
+
+
+#ifdef DOTS_METABALLS
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::metaball( uint8_t* buff )
+{
+    const uint8_t* falloff = StaticTable< MetaballFalloff >::table;
+    memset( m_field, 0, sizeof( m_field ) );
+
+    // each ball only touches its own bounding box, clipped to the buffer, one row span at a time
+    for( uint8_t i = 0; i < m_metaballs; i++ )
+    {
+      PulseState* state     = &m_dot[i];
+      uint8_t     intensity = pulse_intensity( state );
+      uint8_t     x         = state->x;
+      uint8_t     y         = state->y;
+      move_dot_randomly( state );
+
+      if( !intensity || x >= Width || y >= Height )
+        continue;
+
+      uint8_t left   = x > kMetaballRadius ? x - kMetaballRadius : 0;
+      uint8_t right  = x + kMetaballRadius < Width ? x + kMetaballRadius : Width - 1;
+      uint8_t top    = y > kMetaballRadius ? y - kMetaballRadius : 0;
+      uint8_t bottom = y + kMetaballRadius < Height ? y + kMetaballRadius : Height - 1;
+
+      const uint8_t* weights = &falloff[(top + kMetaballRadius - y) * MetaballFalloff::kSpan + left + kMetaballRadius - x];
+      for( uint8_t row = top; row <= bottom; row++, weights += MetaballFalloff::kSpan )
+        field_accumulate_span( &m_field[row * Width + left], weights, right - left + 1, intensity );
+    }
+
+    // shade the field, below the threshold is outside every ball
+    for( uint16_t i = 0; i < kBufferSize; i++ )
+    {
+      uint16_t field = m_field[i];
+      if( field <= kMetaballThreshold )
+      {
+        put( &buff[i], 0 );
+        continue;
+      }
+
+      uint32_t shade = ((uint32_t)(field - kMetaballThreshold) * kMetaballGain) >> 8;
+      put( &buff[i], Pixel::encode( shade > 255 ? 255 : shade ) );
+    }
+}
+#endif // DOTS_METABALLS
+
+
+// all on (low), test code...
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::all_on_low( uint8_t* buff )
+{
+    pixel_fill( buff, kBufferSize, 1 );
+}
+
+
+#pragma mark -
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::setup( uint32_t seed )
+{
+    m_seed           = seed ? seed : 1;
+    m_frame          = 0;
+    m_mode           = kDotsMode_BlobAccel;
+    m_max_brightness = kMaxBrightness;
+    m_num_steps      = kNumSteps;
+    m_accumulate     = false;
+    m_decay_factor   = pixel_decay_factor( kTrailHalfLife );
+    m_metaballs      = kMetaballCount < Dots ? kMetaballCount : Dots;
+    pixel_fill( m_buffer, kBufferSize, 0 );
+
+    for( int i = 0; i < Dots; i++ )
+    {
+#ifdef RANDOM_DURATION
+        m_dot[i].num_steps      = rand_range( kMinDotSteps, kNumSteps );
+        m_dot[i].step           = rand_range( 0, m_dot[i].num_steps );
+#else
+        m_dot[i].num_steps      = kNumSteps;
+        m_dot[i].step           = rand_range( 0, kNumSteps );
+#endif
+        m_dot[i].x              = rand_range( 0, Width );
+        m_dot[i].y              = rand_range( 0, Height );
+
+        // now make a few dots exceptionally bright
+        if( rand_range( 0, 2 ) )
+          m_dot[i].max_brightness = kOverBrightness;
+        else
+          m_dot[i].max_brightness = rand_range( 0, m_max_brightness );
+    }
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::set_max_brightness( uint8_t brightness )
+{
+    // re-roll the ordinary dots under the new ceiling, the exceptionally bright ones stay that way
+    m_max_brightness = brightness;
+    for( int i = 0; i < Dots; i++ )
+    {
+        if( m_dot[i].max_brightness != kOverBrightness )
+          m_dot[i].max_brightness = rand_range( 0, m_max_brightness );
+    }
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::set_num_steps( uint32_t num_steps )
+{
+    if( num_steps < kMinDotSteps )
+        num_steps = kMinDotSteps;
+
+    // keep every dot at the same point in its pulse, just stretched or squashed
+    for( int i = 0; i < Dots; i++ )
+    {
+#ifdef RANDOM_DURATION
+        uint32_t steps = rand_range( kMinDotSteps, num_steps );
+#else
+        uint32_t steps = num_steps;
+#endif
+        m_dot[i].step      = m_dot[i].step * steps / m_dot[i].num_steps;
+        m_dot[i].num_steps = steps;
+    }
+    m_num_steps = num_steps;
+}
+
+
+template< uint8_t Width, uint8_t Height, uint8_t Dots, class Pixel >
+void PulsingDotsRenderer<Width, Height, Dots, Pixel>::draw( float x, float y, float z, uint8_t erase_mode )
+{
+    // erase buffer
+    if( erase_mode == kEraseMode_Clear )
+        pixel_fill( m_buffer, kBufferSize, 0 );
+
+    // or let the last frame fade out by a fixed fraction, it costs about the same as the clear
+    if( erase_mode == kEraseMode_Decay )
+        pixel_decay( m_buffer, kBufferSize, m_decay_factor );
+
+    m_accumulate = (erase_mode == kEraseMode_Decay);
+
+    // erase to non-black for a test to increase brightness
+//    if( erase_mode )
+//        pixel_fill( m_buffer, kBufferSize, 0xff );
+
+    switch( m_mode )
+    {
+        case kDotsMode_BlobAccel:
+          blob_accel( m_buffer, x, y, z );
+          break;
+
+        case kDotsMode_Cloud:
+          cloud( m_buffer );
+          break;
+
+        case kDotsMode_Disappearing:
+          disappearing( m_buffer );
+          break;
+
+        case kDotsMode_DisappearingAccel:
+          disappearing_accel( m_buffer, y, x, z );
+          break;
+
+        case kDotsMode_Metaball:
+#ifdef DOTS_METABALLS
+          metaball( m_buffer );
+          break;
+#endif
+          // fall through - blob is the closest look without the field
+        case kDotsMode_Blob:
+          blob( m_buffer );
+          break;
+
+        case kDotsMode_AllOnLow:
+          all_on_low( m_buffer );  // for debugging
+          break;
+    }
+}
+
+
+#endif // pulsing_dots_renderer_h
+// EOF
@@ -0,0 +1,180 @@
+//
+//  scheduler.cpp
+//
+
+#ifndef ARDUINO_SAMD_ZERO
+#include <avr/sleep.h>
+#endif
+
+#include "scheduler.h"
+#include "profiler.h"
+
+
+// Defines -----------------------------------------------------------------
+
+// the tick interrupt (SysTick on SAMD, Timer0 on AVR) wakes us about every millisecond, so
+// any wait shorter than that is spun instead of slept to keep releases on time
+static const uint32_t kSchedulerSpinUS = 1100;
+
+
+// Constants and static data ---------------------------------------------
+
+static SchedulerTask  s_tasks[kSchedulerMaxTasks];
+static uint8_t        s_task_count = 0;
+
+
+// Private API -----------------------------------------------------------------
+
+void     scheduler_idle( uint32_t until_us );
+void     scheduler_finished( SchedulerTask* task, uint32_t now );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+uint8_t scheduler_add( SchedulerProc proc, uint8_t profile, uint32_t period_us, uint32_t deadline_us )
+{
+  if( s_task_count >= kSchedulerMaxTasks )
+    return kSchedulerMaxTasks;
+
+  SchedulerTask* task = &s_tasks[s_task_count];
+  memset( task, 0, sizeof( SchedulerTask ) );
+  task->proc       = proc;
+  task->profile    = profile;
+  task->release_us = micros();
+  scheduler_set_period( s_task_count, period_us, deadline_us );
+  return s_task_count++;
+}
+
+
+void scheduler_set_period( uint8_t task, uint32_t period_us, uint32_t deadline_us )
+{
+  if( task >= kSchedulerMaxTasks )
+    return;
+
+  period_us = period_us ? period_us : 1;
+  s_tasks[task].period_us   = period_us;
+  s_tasks[task].deadline_us = deadline_us && deadline_us < period_us ? deadline_us : period_us;
+}
+
+
+void scheduler_start()
+{
+  uint32_t now = micros();
+  for( uint8_t i = 0; i < s_task_count; i++ )
+    s_tasks[i].release_us = now;
+}
+
+
+void scheduler_run()
+{
+  // earliest deadline first among the tasks that are due
+  uint32_t       now  = micros();
+  SchedulerTask* next = NULL;
+  for( uint8_t i = 0; i < s_task_count; i++ )
+  {
+    SchedulerTask* task = &s_tasks[i];
+    if( (int32_t)(now - task->release_us) < 0 )
+      continue;
+
+    if( !next || (int32_t)((task->release_us + task->deadline_us) - (next->release_us + next->deadline_us)) < 0 )
+      next = task;
+  }
+
+  if( next )
+  {
+    profiler_start( next->profile );
+    next->proc();
+    profiler_stop( next->profile );
+    scheduler_finished( next, micros() );
+    return;
+  }
+
+  // nothing due, doze until the soonest release
+  uint32_t until = s_tasks[0].release_us;
+  for( uint8_t i = 1; i < s_task_count; i++ )
+  {
+    if( (int32_t)(s_tasks[i].release_us - until) < 0 )
+      until = s_tasks[i].release_us;
+  }
+
+  if( s_task_count )
+  {
+    profiler_start( kProfile_Idle );
+    scheduler_idle( until );
+    profiler_stop( kProfile_Idle );
+  }
+}
+
+
+#pragma mark -
+
+uint8_t scheduler_task_count()
+{
+  return s_task_count;
+}
+
+
+const SchedulerTask* scheduler_task( uint8_t task )
+{
+  return &s_tasks[task];
+}
+
+
+void scheduler_reset_counters()
+{
+  for( uint8_t i = 0; i < s_task_count; i++ )
+  {
+    s_tasks[i].misses        = 0;
+    s_tasks[i].worst_late_us = 0;
+  }
+}
+
+
+#pragma mark -
+
+void scheduler_finished( SchedulerTask* task, uint32_t now )
+{
+  uint32_t taken = now - task->release_us;
+  if( taken > task->deadline_us )
+  {
+    uint32_t late = taken - task->deadline_us;
+    task->misses++;
+    if( late > task->worst_late_us )
+      task->worst_late_us = late;
+  }
+
+  // stay on the period grid, but don't try to catch up on periods that are already gone
+  task->release_us += task->period_us;
+  uint32_t behind = now - task->release_us;
+  if( (int32_t)behind >= (int32_t)task->period_us )
+  {
+    uint32_t skipped = behind / task->period_us;
+    task->misses     += skipped;
+    task->release_us += skipped * task->period_us;
+  }
+}
+
+
+void scheduler_idle( uint32_t until_us )
+{
+#ifdef ARDUINO_SAMD_ZERO
+  SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;     // RTCZero leaves standby selected after a motion sleep
+#endif
+
+  while( (int32_t)(until_us - micros()) > (int32_t)kSchedulerSpinUS )
+  {
+#ifdef ARDUINO_SAMD_ZERO
+    __WFI();                              // plain sleep, SysTick and USB keep running
+#else
+    set_sleep_mode( SLEEP_MODE_IDLE );    // Timer0 keeps millis() going and wakes us
+    sleep_mode();
+#endif
+  }
+
+  while( (int32_t)(until_us - micros()) > 0 )
+    ;
+}
+
+// EOF
@@ -0,0 +1,54 @@
+//
+//  scheduler.h
+//
+//  Small cooperative scheduler, so each stage of the sketch runs at its own rate instead of
+//  everything once per pass through loop().  Tasks are released every period and the due task
+//  with the earliest deadline runs to completion; when nothing is due the CPU sleeps until the
+//  next release.  Run times are charged to a profiler stage and late finishes are counted per
+//  task, which together show which stage holds the frame rate back.
+//
+
+#ifndef scheduler_h
+#define scheduler_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kSchedulerMaxTasks = 6;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef void (*SchedulerProc)();
+
+typedef struct
+{
+  SchedulerProc proc;
+  uint8_t       profile;          // profiler stage the run time goes to
+  uint32_t      period_us;
+  uint32_t      deadline_us;      // from release to finished
+  uint32_t      release_us;       // next time it is due
+  uint32_t      misses;           // finished past the deadline, or lost whole periods
+  uint32_t      worst_late_us;
+} SchedulerTask;
+
+
+// Public API -----------------------------------------------------------------
+
+// tasks released together run in the order they were added, returns the task index
+uint8_t              scheduler_add( SchedulerProc proc, uint8_t profile, uint32_t period_us, uint32_t deadline_us );
+void                 scheduler_set_period( uint8_t task, uint32_t period_us, uint32_t deadline_us );
+
+void                 scheduler_start();       // releases every task now, also after a long sleep
+void                 scheduler_run();         // from loop(): one task, or sleep until one is due
+
+uint8_t              scheduler_task_count();
+const SchedulerTask* scheduler_task( uint8_t task );
+void                 scheduler_reset_counters();
+
+
+#endif // scheduler_h
+// EOF
@@ -0,0 +1,47 @@
+//
+//  static_table.h
+//
+//  Lookup tables filled in by the compiler instead of pasted in by hand.  A generator is a
+//  struct with a value_type, a kCount and a constexpr value( i ); StaticTable< Generator >::table
+//  is then a PROGMEM array of value( 0 ) .. value( kCount - 1 ).  C++11 only, so no
+//  std::integer_sequence - make_index_list does the same job.
+//
+
+#ifndef static_table_h
+#define static_table_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Data types -----------------------------------------------------------------
+
+template< uint16_t... I >
+struct index_list {};
+
+template< uint16_t N, uint16_t... I >
+struct make_index_list : make_index_list< N - 1, N - 1, I... > {};
+
+template< uint16_t... I >
+struct make_index_list< 0, I... >
+{
+  typedef index_list< I... > type;
+};
+
+
+template< class Generator, class Indices = typename make_index_list< Generator::kCount >::type >
+struct StaticTable;
+
+template< class Generator, uint16_t... I >
+struct StaticTable< Generator, index_list< I... > >
+{
+  typedef typename Generator::value_type value_type;
+  static const value_type PROGMEM table[sizeof...( I )];
+};
+
+template< class Generator, uint16_t... I >
+const typename Generator::value_type PROGMEM StaticTable< Generator, index_list< I... > >::table[sizeof...( I )] = { Generator::value( I )... };
+
+
+#endif // static_table_h
+// EOF
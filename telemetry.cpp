@@ -0,0 +1,481 @@
+//
+//  telemetry.cpp
+//
+
+#include "telemetry.h"
+#include "pulsing_dots.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "brightness.h"
+#include "i2c_clock.h"
+#include "display_controller.h"
+
+
+// Defines -----------------------------------------------------------------
+
+enum
+{
+  kRxState_Sync1 = 0,
+  kRxState_Sync2,
+  kRxState_Type,
+  kRxState_LengthLo,
+  kRxState_LengthHi,
+  kRxState_Payload,
+  kRxState_Checksum
+};
+
+static const uint8_t  kTelemetryHeaderSize   = 5;     // sync, sync, type, length
+static const uint8_t  kTelemetryMaxCommand   = 8;     // longest payload we accept from the host
+static const uint8_t  kTelemetryRxBudget     = 16;    // bytes parsed per frame, at most
+static const uint8_t  kTelemetryTxBudget     = 64;    // bytes sent per frame, at most
+
+static const uint16_t kTelemetryCountersSize = 1 + kProfileCount * 4 * sizeof( uint32_t );
+static const uint16_t kTelemetryTasksSize    = 1 + kSchedulerMaxTasks * (1 + 3 * sizeof( uint32_t ));
+static const uint16_t kTelemetryI2CSize      = 1 + kI2CBusCount * 6 * sizeof( uint32_t );
+static const uint16_t kTelemetryQueueSize    = 2 + 2 * sizeof( uint32_t );
+static_assert( kTelemetryTasksSize <= kTelemetryCountersSize, "task message won't fit the send buffer" );
+static_assert( kTelemetryI2CSize <= kTelemetryCountersSize, "i2c message won't fit the send buffer" );
+#ifdef TELEMETRY_FRAMES
+static const uint16_t kTelemetryFrameSize    = 6 + kMaxWidth * kMaxHeight;
+static const uint16_t kTelemetryMaxMessage   = kTelemetryFrameSize > kTelemetryCountersSize ? kTelemetryFrameSize : kTelemetryCountersSize;
+#else
+static const uint16_t kTelemetryMaxMessage   = kTelemetryCountersSize;
+#endif
+
+
+// Constants and static data ---------------------------------------------
+
+static LiveSettings*  s_settings       = NULL;
+static uint32_t       s_frame_number   = 0;
+
+// receive side
+static uint8_t        s_rx_state       = kRxState_Sync1;
+static uint8_t        s_rx_type        = 0;
+static uint16_t       s_rx_length      = 0;
+static uint16_t       s_rx_count       = 0;
+static uint8_t        s_rx_sum         = 0;
+static uint8_t        s_rx_payload[kTelemetryMaxCommand];
+
+// what the host asked us to stream
+static uint8_t        s_stream_flags   = 0;
+static uint8_t        s_frame_interval = 0;
+static uint8_t        s_counter_interval = 0;
+static uint8_t        s_frame_countdown = 0;
+static uint8_t        s_counter_countdown = 0;
+static bool           s_tasks_pending  = false;
+static bool           s_i2c_pending    = false;
+static bool           s_queue_pending  = false;
+
+// one pending ack, it jumps the queue
+static bool           s_ack_pending    = false;
+static uint8_t        s_ack_command    = 0;
+static uint8_t        s_ack_status     = 0;
+
+// send side, one message in flight drained a little every frame
+static uint8_t        s_tx_buffer[kTelemetryHeaderSize + kTelemetryMaxMessage + 1];
+static uint16_t       s_tx_length      = 0;
+static uint16_t       s_tx_sent        = 0;
+
+
+// Private API -----------------------------------------------------------------
+
+void     rx_poll();
+void     rx_handle_command( uint8_t type, const uint8_t* payload, uint16_t length );
+uint8_t  rx_set_param( uint8_t param, uint16_t value );
+void     tx_queue_ack( uint8_t command, uint8_t status );
+
+void     tx_compose_next( const uint8_t* frame, uint8_t width, uint8_t height );
+uint8_t* tx_begin_message( uint8_t type, uint16_t length );
+void     tx_end_message();
+uint8_t* tx_put_u32( uint8_t* p, uint32_t value );
+void     tx_drain();
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void telemetry_setup( LiveSettings* settings )
+{
+    s_settings     = settings;
+    s_rx_state     = kRxState_Sync1;
+    s_stream_flags = 0;
+    s_tx_length    = 0;
+    s_tx_sent      = 0;
+}
+
+
+void telemetry_tick( const uint8_t* frame, uint8_t width, uint8_t height )
+{
+    ++s_frame_number;
+
+    rx_poll();
+
+    // only start a new message once the last one has fully drained
+    if( s_tx_sent >= s_tx_length )
+        tx_compose_next( frame, width, height );
+
+    tx_drain();
+}
+
+
+#pragma mark -
+
+// Receive -----------------------------------------------------------------
+
+void rx_poll()
+{
+    for( uint8_t budget = kTelemetryRxBudget; budget && Serial.available() > 0; budget-- )
+    {
+        uint8_t c = Serial.read();
+
+        switch( s_rx_state )
+        {
+            case kRxState_Sync1:
+                if( c == kTelemetrySync1 )
+                    s_rx_state = kRxState_Sync2;
+                break;
+
+            case kRxState_Sync2:
+                s_rx_state = (c == kTelemetrySync2) ? kRxState_Type : (c == kTelemetrySync1 ? kRxState_Sync2 : kRxState_Sync1);
+                break;
+
+            case kRxState_Type:
+                s_rx_type  = c;
+                s_rx_sum   = c;
+                s_rx_state = kRxState_LengthLo;
+                break;
+
+            case kRxState_LengthLo:
+                s_rx_length = c;
+                s_rx_sum   += c;
+                s_rx_state  = kRxState_LengthHi;
+                break;
+
+            case kRxState_LengthHi:
+                s_rx_length |= (uint16_t)c << 8;
+                s_rx_sum    += c;
+                s_rx_count   = 0;
+                s_rx_state   = s_rx_length ? kRxState_Payload : kRxState_Checksum;
+                break;
+
+            case kRxState_Payload:
+                // anything longer than we care about is summed but not kept, the command gets rejected below
+                if( s_rx_count < kTelemetryMaxCommand )
+                    s_rx_payload[s_rx_count] = c;
+                s_rx_sum += c;
+                if( ++s_rx_count >= s_rx_length )
+                    s_rx_state = kRxState_Checksum;
+                break;
+
+            case kRxState_Checksum:
+                if( c != s_rx_sum )
+                    tx_queue_ack( s_rx_type, kTelemetryStatus_BadChecksum );
+                else if( s_rx_length > kTelemetryMaxCommand )
+                    tx_queue_ack( s_rx_type, kTelemetryStatus_BadCommand );
+                else
+                    rx_handle_command( s_rx_type, s_rx_payload, s_rx_length );
+                s_rx_state = kRxState_Sync1;
+                break;
+        }
+    }
+}
+
+
+void rx_handle_command( uint8_t type, const uint8_t* payload, uint16_t length )
+{
+    uint8_t status = kTelemetryStatus_OK;
+
+    switch( type )
+    {
+        case kTelemetryCmd_SetParam:
+            if( length < 3 )
+                status = kTelemetryStatus_BadCommand;
+            else
+                status = rx_set_param( payload[0], payload[1] | ((uint16_t)payload[2] << 8) );
+            break;
+
+        case kTelemetryCmd_SetMode:
+            if( length < 1 || payload[0] >= kDotsModeCount )
+                status = kTelemetryStatus_BadValue;
+            else
+                pulsing_dots_set_mode( payload[0] );
+            break;
+
+        case kTelemetryCmd_Stream:
+            if( length < 3 )
+            {
+                status = kTelemetryStatus_BadCommand;
+                break;
+            }
+            s_stream_flags      = payload[0];
+            s_frame_interval    = payload[1];
+            s_counter_interval  = payload[2];
+            s_frame_countdown   = 0;
+            s_counter_countdown = 0;
+#ifndef TELEMETRY_FRAMES
+            if( s_stream_flags & kTelemetryStream_Frames )
+                status = kTelemetryStatus_BadValue;   // counters still stream, just no pictures
+#endif
+            break;
+
+        case kTelemetryCmd_Ping:
+            break;
+
+        case kTelemetryCmd_Calibrate:
+            s_settings->recalibrate = true;
+            break;
+
+        default:
+            status = kTelemetryStatus_BadCommand;
+            break;
+    }
+
+    tx_queue_ack( type, status );
+}
+
+
+uint8_t rx_set_param( uint8_t param, uint16_t value )
+{
+    switch( param )
+    {
+        case kTelemetryParam_MaxBrightness:
+            if( value > 255 )
+                return kTelemetryStatus_BadValue;
+            pulsing_dots_set_max_brightness( value );
+            break;
+
+        case kTelemetryParam_NumSteps:
+            pulsing_dots_set_num_steps( value );
+            break;
+
+        case kTelemetryParam_AccelScale:
+            s_settings->accel_scale = value * 0.01f;
+            break;
+
+        case kTelemetryParam_EraseMode:
+            if( value > kEraseMode_Decay )
+                return kTelemetryStatus_BadValue;
+            s_settings->erase_mode = value;
+            break;
+
+        case kTelemetryParam_TrailHalfLife:
+            pulsing_dots_set_trail_half_life( value );
+            break;
+
+        case kTelemetryParam_FrameDelay:
+            s_settings->frame_delay_ms = value;
+            break;
+
+        case kTelemetryParam_Metaballs:
+            if( !value || value > kMaxDots )
+                return kTelemetryStatus_BadValue;
+            pulsing_dots_set_metaball_count( value );
+            break;
+
+        case kTelemetryParam_Brightness:
+            if( value > kBrightnessFull )
+                return kTelemetryStatus_BadValue;
+            brightness_set_level( value );
+            break;
+
+        case kTelemetryParam_QueueDepth:
+            if( !value || value > kDisplayQueueMax )
+                return kTelemetryStatus_BadValue;
+            display_queue_set_target( value );
+            break;
+
+        default:
+            return kTelemetryStatus_BadValue;
+    }
+
+    return kTelemetryStatus_OK;
+}
+
+
+void tx_queue_ack( uint8_t command, uint8_t status )
+{
+    // if the host fires commands faster than we drain, it only hears about the latest one
+    s_ack_pending = true;
+    s_ack_command = command;
+    s_ack_status  = status;
+}
+
+
+#pragma mark -
+
+// Transmit -----------------------------------------------------------------
+
+void tx_compose_next( const uint8_t* frame, uint8_t width, uint8_t height )
+{
+    bool counter_due = false;
+#ifdef TELEMETRY_FRAMES
+    bool frame_due   = false;
+
+    if( s_stream_flags & kTelemetryStream_Frames )
+    {
+        if( s_frame_countdown )
+            --s_frame_countdown;
+        frame_due = !s_frame_countdown;
+    }
+#endif
+
+    if( s_stream_flags & kTelemetryStream_Counters )
+    {
+        if( s_counter_countdown )
+            --s_counter_countdown;
+        counter_due = !s_counter_countdown;
+    }
+
+    if( s_ack_pending )
+    {
+        uint8_t* p = tx_begin_message( kTelemetryMsg_Ack, 2 );
+        p[0] = s_ack_command;
+        p[1] = s_ack_status;
+        tx_end_message();
+        s_ack_pending = false;
+        return;
+    }
+
+    if( counter_due )
+    {
+        uint8_t* p = tx_begin_message( kTelemetryMsg_Counters, kTelemetryCountersSize );
+        *p++ = kProfileCount;
+        for( uint8_t i = 0; i < kProfileCount; i++ )
+        {
+            const ProfileCounter* counter = profiler_counter( i );
+            p = tx_put_u32( p, counter->last_us );
+            p = tx_put_u32( p, counter->max_us );
+            p = tx_put_u32( p, counter->total_us );
+            p = tx_put_u32( p, counter->count );
+        }
+        tx_end_message();
+        s_counter_countdown = s_counter_interval + 1;
+        s_tasks_pending     = true;
+        return;
+    }
+
+    if( s_tasks_pending )
+    {
+        uint8_t  count = scheduler_task_count();
+        uint8_t* p     = tx_begin_message( kTelemetryMsg_Tasks, 1 + count * (1 + 3 * sizeof( uint32_t )) );
+        *p++ = count;
+        for( uint8_t i = 0; i < count; i++ )
+        {
+            const SchedulerTask* task = scheduler_task( i );
+            *p++ = task->profile;
+            p = tx_put_u32( p, task->period_us );
+            p = tx_put_u32( p, task->misses );
+            p = tx_put_u32( p, task->worst_late_us );
+        }
+        tx_end_message();
+        s_tasks_pending = false;
+        s_i2c_pending   = true;
+        return;
+    }
+
+    if( s_i2c_pending )
+    {
+        uint8_t* p = tx_begin_message( kTelemetryMsg_I2C, kTelemetryI2CSize );
+        *p++ = kI2CBusCount;
+        for( uint8_t bus = 0; bus < kI2CBusCount; bus++ )
+        {
+            const I2CFaults* faults = i2c_faults( bus );
+            p = tx_put_u32( p, faults->errors );
+            p = tx_put_u32( p, faults->timeouts );
+            p = tx_put_u32( p, faults->retries );
+            p = tx_put_u32( p, faults->recoveries );
+            p = tx_put_u32( p, faults->recovery_us );
+            p = tx_put_u32( p, faults->skipped );
+        }
+        tx_end_message();
+        s_i2c_pending   = false;
+        s_queue_pending = true;
+        return;
+    }
+
+    if( s_queue_pending )
+    {
+        const DisplayQueue* queue = display_queue();
+        uint8_t* p = tx_begin_message( kTelemetryMsg_Queue, kTelemetryQueueSize );
+        *p++ = queue->depth;
+        *p++ = queue->target;
+        p = tx_put_u32( p, queue->presented );
+        p = tx_put_u32( p, queue->underruns );
+        tx_end_message();
+        s_queue_pending = false;
+        return;
+    }
+
+#ifdef TELEMETRY_FRAMES
+    if( frame_due && frame )
+    {
+        uint16_t pixels = (uint16_t)width * height;
+        if( pixels > kMaxWidth * kMaxHeight )
+            return;
+
+        // snapshot the frame, it will be drawn over long before the last byte goes out
+        uint8_t* p = tx_begin_message( kTelemetryMsg_Frame, 6 + pixels );
+        p = tx_put_u32( p, s_frame_number );
+        *p++ = width;
+        *p++ = height;
+        memcpy( p, frame, pixels );
+        tx_end_message();
+        s_frame_countdown = s_frame_interval + 1;
+    }
+#endif
+}
+
+
+uint8_t* tx_begin_message( uint8_t type, uint16_t length )
+{
+    s_tx_buffer[0] = kTelemetrySync1;
+    s_tx_buffer[1] = kTelemetrySync2;
+    s_tx_buffer[2] = type;
+    s_tx_buffer[3] = length & 0xFF;
+    s_tx_buffer[4] = length >> 8;
+    s_tx_length    = kTelemetryHeaderSize + length;
+    s_tx_sent      = 0;
+    return &s_tx_buffer[kTelemetryHeaderSize];
+}
+
+
+void tx_end_message()
+{
+    uint8_t sum = 0;
+    for( uint16_t i = 2; i < s_tx_length; i++ )
+        sum += s_tx_buffer[i];
+    s_tx_buffer[s_tx_length++] = sum;
+}
+
+
+uint8_t* tx_put_u32( uint8_t* p, uint32_t value )
+{
+    *p++ = value;
+    *p++ = value >> 8;
+    *p++ = value >> 16;
+    *p++ = value >> 24;
+    return p;
+}
+
+
+void tx_drain()
+{
+    if( s_tx_sent >= s_tx_length )
+        return;
+
+    // never hand Serial more than it can take without blocking
+    int room = Serial.availableForWrite();
+    if( room <= 0 )
+        return;
+
+    uint16_t count = s_tx_length - s_tx_sent;
+    if( count > (uint16_t)room )
+        count = room;
+    if( count > kTelemetryTxBudget )
+        count = kTelemetryTxBudget;
+
+    s_tx_sent += Serial.write( &s_tx_buffer[s_tx_sent], count );
+}
+
+// EOF
@@ -0,0 +1,100 @@
+//
+//  telemetry.h
+//
+//  Binary tuning/telemetry channel over Serial, so we can poke at parameters and watch
+//  frames without reflashing.  Everything is done a few bytes at a time from loop(),
+//  nothing here ever waits on the serial port.
+//
+//  Packets in both directions look like:
+//
+//      0xA5 0x5A  type  length(lo, hi)  payload[length]  checksum
+//
+//  where checksum is the low byte of the sum of type, both length bytes and the payload.
+//
+
+#ifndef telemetry_h
+#define telemetry_h
+
+#include <stdio.h>
+#include <Arduino.h>
+
+
+// Defines -----------------------------------------------------------------
+
+#ifdef ARDUINO_SAMD_ZERO
+#define TELEMETRY_FRAMES     // frame capture needs a snapshot buffer, too much for the Pro Trinket
+#endif
+
+static const uint8_t  kTelemetrySync1    = 0xA5;
+static const uint8_t  kTelemetrySync2    = 0x5A;
+
+
+// Data types -----------------------------------------------------------------
+
+// host -> device
+enum
+{
+  kTelemetryCmd_SetParam  = 0x01,   // param, value (uint16)
+  kTelemetryCmd_SetMode   = 0x02,   // kDotsMode_*
+  kTelemetryCmd_Stream    = 0x03,   // flags, frame interval, counter interval (in frames, 0 = every frame)
+  kTelemetryCmd_Ping      = 0x04,
+  kTelemetryCmd_Calibrate = 0x05    // rerun the I2C clock calibration
+};
+
+// device -> host
+enum
+{
+  kTelemetryMsg_Ack      = 0x80,    // command, status
+  kTelemetryMsg_Frame    = 0x81,    // frame number (uint32), width, height, pixels
+  kTelemetryMsg_Counters = 0x82,    // stage count, then last/max/total/count (uint32s) per profiler stage
+  kTelemetryMsg_Tasks    = 0x83,    // task count, then stage (uint8), period/misses/worst late (uint32s) per scheduler task
+  kTelemetryMsg_I2C      = 0x84,    // bus count, then errors/timeouts/retries/recoveries/recovery us/skipped (uint32s) per bus
+  kTelemetryMsg_Queue    = 0x85     // frame queue depth, target (uint8s), presented, underruns (uint32s)
+};
+
+enum
+{
+  kTelemetryStatus_OK = 0,
+  kTelemetryStatus_BadChecksum,
+  kTelemetryStatus_BadCommand,
+  kTelemetryStatus_BadValue
+};
+
+enum
+{
+  kTelemetryStream_Frames   = 0x01,
+  kTelemetryStream_Counters = 0x02     // the scheduler tasks follow each counters message
+};
+
+enum
+{
+  kTelemetryParam_MaxBrightness = 0,
+  kTelemetryParam_NumSteps,
+  kTelemetryParam_AccelScale,       // in hundredths
+  kTelemetryParam_EraseMode,
+  kTelemetryParam_TrailHalfLife,
+  kTelemetryParam_FrameDelay,       // ms
+  kTelemetryParam_Metaballs,        // dots drawn by kDotsMode_Metaball
+  kTelemetryParam_Brightness,       // global level, 0..256 (see brightness.h)
+  kTelemetryParam_QueueDepth        // frames the render may get ahead, 1..kDisplayQueueMax
+};
+
+
+// the parts of the sketch that live tuning can reach which don't belong to the renderer
+typedef struct
+{
+  float    accel_scale;
+  uint8_t  erase_mode;
+  uint16_t frame_delay_ms;
+  bool     recalibrate;       // set by the host, cleared once the I2C clock has been recalibrated
+} LiveSettings;
+
+
+// Public API -----------------------------------------------------------------
+
+void     telemetry_setup( LiveSettings* settings );
+void     telemetry_tick( const uint8_t* frame, uint8_t width, uint8_t height );   // once per frame
+
+
+#endif // telemetry_h
+// EOF
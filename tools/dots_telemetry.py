@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+#
+#  dots_telemetry.py
+#
+#  Host side of the telemetry channel in telemetry.h.  Needs pyserial for talking to the board,
+#  replaying a capture doesn't.
+#
+#    dots_telemetry.py PORT set accel_scale 75
+#    dots_telemetry.py PORT mode cloud
+#    dots_telemetry.py PORT counters
+#    dots_telemetry.py PORT calibrate
+#    dots_telemetry.py PORT capture frames.bin --count 300 --every 2
+#    dots_telemetry.py replay frames.bin --fps 30
+#
+
+import argparse
+import struct
+import sys
+import time
+
+SYNC = b'\xA5\x5A'
+
+CMD_SET_PARAM, CMD_SET_MODE, CMD_STREAM, CMD_PING, CMD_CALIBRATE = 0x01, 0x02, 0x03, 0x04, 0x05
+MSG_ACK, MSG_FRAME, MSG_COUNTERS, MSG_TASKS, MSG_I2C, MSG_QUEUE = 0x80, 0x81, 0x82, 0x83, 0x84, 0x85
+STREAM_FRAMES, STREAM_COUNTERS = 0x01, 0x02
+
+PARAMS = ['max_brightness', 'num_steps', 'accel_scale', 'erase_mode', 'trail_half_life', 'frame_delay', 'metaballs', 'brightness', 'queue_depth']
+MODES = ['blob_accel', 'cloud', 'disappearing', 'disappearing_accel', 'blob', 'all_on_low', 'metaball']
+STAGES = ['flicker', 'accel', 'render', 'upload', 'frame', 'boot', 'wake', 'idle', 'present']
+STATUS = ['ok', 'bad checksum', 'bad command', 'bad value']
+SHADES = ' .:-=+*#%@'
+
+
+def packet(kind, payload=b''):
+    body = bytes([kind]) + struct.pack('<H', len(payload)) + payload
+    return SYNC + body + bytes([sum(body) & 0xFF])
+
+
+def read_packets(stream):
+    """yields (type, payload) from anything with a read(n), skipping junk and bad checksums"""
+    buf = b''
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            if hasattr(stream, 'in_waiting'):
+                continue    # serial timeout, keep listening
+            return
+        buf += chunk
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                buf = buf[-1:]
+                break
+            if len(buf) < start + 5:
+                buf = buf[start:]
+                break
+            kind = buf[start + 2]
+            length = struct.unpack_from('<H', buf, start + 3)[0]
+            end = start + 5 + length + 1
+            if len(buf) < end:
+                buf = buf[start:]
+                break
+            body = buf[start + 2:end - 1]
+            if (sum(body) & 0xFF) == buf[end - 1]:
+                yield kind, bytes(body[3:])
+                buf = buf[end:]
+            else:
+                buf = buf[start + 1:]
+
+
+def wait_ack(port, command):
+    for kind, payload in read_packets(port):
+        if kind == MSG_ACK and payload[0] == command:
+            print(STATUS[payload[1]] if payload[1] < len(STATUS) else 'status %d' % payload[1])
+            return payload[1] == 0
+
+
+def show_frame(payload, out=sys.stdout):
+    number, width, height = struct.unpack_from('<IBB', payload)
+    pixels = payload[6:]
+    lines = ['frame %d' % number]
+    for y in range(height):
+        row = pixels[y * width:(y + 1) * width]
+        lines.append(''.join(SHADES[p * (len(SHADES) - 1) // 255] * 2 for p in row))
+    out.write('\x1b[H\x1b[J' + '\n'.join(lines) + '\n')
+    out.flush()
+
+
+def open_port(name):
+    import serial
+    return serial.Serial(name, 115200, timeout=0.5)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='pulsing dots live tuning and frame capture')
+    parser.add_argument('port', help='serial port, or "replay"')
+    parser.add_argument('command', help='set, mode, counters, calibrate, capture, or the capture file when replaying')
+    parser.add_argument('args', nargs='*')
+    parser.add_argument('--count', type=int, default=100, help='frames to capture')
+    parser.add_argument('--every', type=int, default=1, help='capture every Nth frame')
+    parser.add_argument('--fps', type=float, default=30.0, help='replay rate')
+    opts = parser.parse_args()
+
+    if opts.port == 'replay':
+        with open(opts.command, 'rb') as f:
+            for kind, payload in read_packets(f):
+                if kind == MSG_FRAME:
+                    show_frame(payload)
+                    time.sleep(1.0 / opts.fps)
+        return
+
+    port = open_port(opts.port)
+
+    if opts.command == 'set':
+        param, value = PARAMS.index(opts.args[0]), int(opts.args[1])
+        port.write(packet(CMD_SET_PARAM, struct.pack('<BH', param, value)))
+        wait_ack(port, CMD_SET_PARAM)
+
+    elif opts.command == 'mode':
+        port.write(packet(CMD_SET_MODE, bytes([MODES.index(opts.args[0])])))
+        wait_ack(port, CMD_SET_MODE)
+
+    elif opts.command == 'calibrate':
+        port.write(packet(CMD_CALIBRATE))
+        wait_ack(port, CMD_CALIBRATE)
+
+    elif opts.command == 'counters':
+        port.write(packet(CMD_STREAM, bytes([STREAM_COUNTERS, 0, 0])))
+        for kind, payload in read_packets(port):
+            if kind == MSG_COUNTERS:
+                for i in range(payload[0]):
+                    last, worst, total, count = struct.unpack_from('<IIII', payload, 1 + i * 16)
+                    name = STAGES[i] if i < len(STAGES) else str(i)
+                    print('%-8s last %6d us  max %6d us  avg %6d us' % (name, last, worst, total // max(count, 1)))
+            elif kind == MSG_TASKS:
+                # the scheduler's view, whichever task misses most is what holds the frame rate back
+                for i in range(payload[0]):
+                    stage, period, misses, late = struct.unpack_from('<BIII', payload, 1 + i * 13)
+                    name = STAGES[stage] if stage < len(STAGES) else str(stage)
+                    print('%-8s every %6d us  missed %6d  worst late %6d us' % (name, period, misses, late))
+            elif kind == MSG_I2C:
+                for bus in range(payload[0]):
+                    errors, timeouts, retries, recoveries, recovery_us, skipped = struct.unpack_from('<IIIIII', payload, 1 + bus * 24)
+                    print('i2c bus %d  errors %d  timeouts %d  retries %d  recoveries %d (%d us)  panels skipped %d' %
+                          (bus, errors, timeouts, retries, recoveries, recovery_us, skipped))
+            elif kind == MSG_QUEUE:
+                # underruns are frames that stayed up twice because the render fell behind
+                depth, target, presented, underruns = struct.unpack_from('<BBII', payload)
+                print('queue    %d of %d waiting  presented %d  underruns %d' % (depth, target, presented, underruns))
+                break
+        port.write(packet(CMD_STREAM, bytes([0, 0, 0])))
+
+    elif opts.command == 'capture':
+        port.write(packet(CMD_STREAM, bytes([STREAM_FRAMES, max(opts.every - 1, 0), 0])))
+        with open(opts.args[0], 'wb') as f:
+            captured = 0
+            for kind, payload in read_packets(port):
+                if kind == MSG_FRAME:
+                    f.write(packet(kind, payload))
+                    captured += 1
+                    if captured >= opts.count:
+                        break
+        port.write(packet(CMD_STREAM, bytes([0, 0, 0])))
+        print('captured %d frames' % captured)
+
+    else:
+        parser.error('unknown command ' + opts.command)
+
+
+if __name__ == '__main__':
+    main()
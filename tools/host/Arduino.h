@@ -0,0 +1,119 @@
+//
+//  Arduino.h
+//
+//  Just enough of the Arduino core for the renderer and flicker engine to build on a desktop.  Put this
+//  directory first on the include path and the sketch headers pick it up instead of the real one.
+//
+
+#ifndef host_arduino_h
+#define host_arduino_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+// Defines -----------------------------------------------------------------
+
+#define PROGMEM
+#define pgm_read_byte( p )   (*(const uint8_t*)(p))
+#define pgm_read_word( p )   (*(const uint16_t*)(p))
+#define pgm_read_dword( p )  (*(const uint32_t*)(p))
+#define pgm_read_ptr( p )    (*(void* const*)(p))
+
+#define HIGH         1
+#define LOW          0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define LED_BUILTIN  13
+
+static const uint8_t SDA = 18;      // where the Pro Trinket has them
+static const uint8_t SCL = 19;
+
+#ifdef ARDUINO_SAMD_ZERO
+// the bits of the M0's port registers i2c_clock.cpp touches, writes go nowhere
+struct HostPinConfig      { struct { uint8_t INEN; } bit; };
+struct HostPortGroup      { HostPinConfig PINCFG[32]; };
+struct HostPort           { HostPortGroup Group[2]; };
+struct HostPinDescription { uint8_t ulPort; uint8_t ulPin; };
+
+inline HostPort* host_port()               { static HostPort s_port; return &s_port; }
+#define PORT  host_port()
+
+static const HostPinDescription g_APinDescription[32] = {};
+
+// and of its SERCOMs, Wire.h reads LOWTOUTEN back to know whether a held SCL times out
+struct HostSercomI2CM
+{
+  struct { struct { uint8_t ENABLE, LOWTOUTEN; } bit; } CTRLA;
+  struct { struct { uint8_t ENABLE, SYSOP; } bit; }     SYNCBUSY;
+  struct { struct { uint8_t BUSSTATE; } bit; }          STATUS;
+};
+struct HostSercom         { HostSercomI2CM I2CM; };
+typedef HostSercom        Sercom;
+
+inline HostSercom* host_sercom( uint8_t n ) { static HostSercom s_sercom[6]; return &s_sercom[n]; }
+#define SERCOM1  host_sercom( 1 )
+#define SERCOM3  host_sercom( 3 )
+#endif
+
+
+// Data types -----------------------------------------------------------------
+
+// Serial goes to stderr so it never ends up mixed into frames written to stdout
+struct HostSerial
+{
+  void begin( unsigned long )              {}
+  void print( const char* s )              { fputs( s, stderr ); }
+  void print( long v )                     { fprintf( stderr, "%ld", v ); }
+  void print( unsigned long v )            { fprintf( stderr, "%lu", v ); }
+  void print( int v )                      { fprintf( stderr, "%d", v ); }
+  void print( unsigned int v )             { fprintf( stderr, "%u", v ); }
+  void print( double v )                   { fprintf( stderr, "%.2f", v ); }
+  template< class T > void println( T v )  { print( v ); fputc( '\n', stderr ); }
+  void println()                           { fputc( '\n', stderr ); }
+};
+
+static HostSerial Serial __attribute__(( unused ));
+
+
+// nothing is wired up on the desktop unless a tool puts a model behind the pins (see Wire.h),
+// unconnected inputs read as pulled up
+struct HostPins
+{
+  virtual ~HostPins()                              {}
+  virtual void mode( uint8_t /*pin*/, uint8_t /*mode*/ )   {}
+  virtual void write( uint8_t /*pin*/, uint8_t /*value*/ ) {}
+  virtual int  read( uint8_t /*pin*/ )                     { return HIGH; }
+};
+
+
+// Public API -----------------------------------------------------------------
+
+// the clock only moves when the tool says so, which is what lets it run faster than real time
+inline uint64_t& host_micros()             { static uint64_t s_us = 0; return s_us; }
+inline unsigned long millis()              { return (uint32_t)(host_micros() / 1000); }
+inline unsigned long micros()              { return (uint32_t)host_micros(); }
+inline void delay( unsigned long ms )      { host_micros() += ms * 1000ULL; }
+inline void delayMicroseconds( unsigned int us ) { host_micros() += us; }
+
+// seeds for the flicker channels and the single instance behind pulsing_dots_setup(), host code seeds instances itself
+inline void randomSeed( unsigned long seed ) { srand( seed ); }
+inline long random( long low, long high )
+{
+  return high > low ? low + rand() % (high - low) : low;
+}
+
+inline HostPins*& host_pins()              { static HostPins s_none; static HostPins* s_pins = &s_none; return s_pins; }
+inline void pinMode( uint8_t pin, uint8_t mode )       { host_pins()->mode( pin, mode ); }
+inline void digitalWrite( uint8_t pin, uint8_t value ) { host_pins()->write( pin, value ); }
+inline int  digitalRead( uint8_t pin )     { return host_pins()->read( pin ); }
+inline void analogWrite( uint8_t, int )    {}
+inline int  analogRead( uint8_t )          { return 0; }
+
+
+#endif // host_arduino_h
+// EOF
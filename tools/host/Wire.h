@@ -0,0 +1,327 @@
+//
+//  Wire.h
+//
+//  A simulated I2C bus so the display and clock code can run on the desktop.  Devices hang off it
+//  as objects, every transaction moves host_micros() on by what it would take at the clock the
+//  sketch programs into TWBR, and faults can be injected: NACKs, slaves that hang on to SDA until
+//  they get clocked free, clock stretching, and SCL held low for a while where nothing helps.
+//
+//  It behaves like the AVR Wire library, 32 byte buffer and setWireTimeout() included.  The tool
+//  defines the one bus, and points host_pins() at it so the recovery code can work the lines.
+//
+//  Built with ARDUINO_SAMD_ZERO it behaves like the M0's instead: 64 byte buffers, no timeout,
+//  setClock() per bus, and a SERCOM constructor so SECOND_I2C_BUS brings up a Wire1 with its own
+//  pins and clock.  A held SDA loses the arbitration at once, and a held SCL is waited out unless
+//  the bus's SERCOM has its SCL low timeout on.  Both buses still share the one host_micros(), so whatever the sketch sends on
+//  them one after the other takes the time of both - busy_us keeps each bus's own share.
+//
+
+#ifndef host_wire_h
+#define host_wire_h
+
+#include "Arduino.h"
+
+
+// Defines -----------------------------------------------------------------
+
+#ifdef ARDUINO_SAMD_ZERO
+static const uint8_t  kHostWireBuffer = 64;
+static const uint8_t  kHostWireSercom = 3;          // Wire's on the Feather M0
+static const uint32_t kHostLowTimeoutUS = 35000;    // the SERCOM's SCL low timeout, 25-35 ms
+#else
+#define BUFFER_LENGTH     32
+#define WIRE_HAS_TIMEOUT
+static const uint8_t  kHostWireBuffer = BUFFER_LENGTH;
+
+#ifndef F_CPU
+#define F_CPU             12000000UL      // Pro Trinket 3V
+#endif
+
+// i2c_clock.cpp programs the AVR's TWI registers directly
+inline uint8_t& host_twsr()               { static uint8_t s_twsr = 0; return s_twsr; }
+inline uint8_t& host_twbr()               { static uint8_t s_twbr = 72; return s_twbr; }
+#define TWSR  host_twsr()
+#define TWBR  host_twbr()
+#endif
+
+static const uint32_t kHostI2CHang = 1000000;    // how long a master without a timeout waits on a dead bus before we call it
+
+
+// Data types -----------------------------------------------------------------
+
+struct HostI2CDevice
+{
+  virtual ~HostI2CDevice()                                  {}
+  virtual bool    write( const uint8_t* data, uint8_t count ) = 0;   // false NACKs it
+  virtual uint8_t read( uint8_t* data, uint8_t count ) = 0;          // returns how many bytes it had
+  virtual bool    keeps_up( uint32_t /*hz*/ )               { return true; }   // false NACKs everything sent that fast
+};
+
+
+#ifdef ARDUINO_SAMD_ZERO
+struct SERCOM { uint8_t index; };
+static SERCOM sercom1 __attribute__(( unused )) = { 1 };
+#endif
+
+
+// chances are per 10000 transactions
+typedef struct
+{
+  uint16_t nack;          // the address or a data byte isn't acknowledged
+  uint16_t stuck;         // a slave loses track mid byte and holds SDA low until it gets clocked free
+  uint16_t stretch;       // a slave holds SCL low for stretch_us part way through
+  uint32_t stretch_us;
+  uint16_t hang;          // SCL held low for hang_us, nothing gets through and clocking doesn't help
+  uint32_t hang_us;
+} HostI2CFaults;
+
+
+class TwoWire : public HostPins
+{
+public:
+  HostI2CFaults faults;
+  uint32_t      transactions;
+  uint64_t      busy_us;        // time this bus has spent on transactions
+
+  TwoWire( uint8_t sda = SDA, uint8_t scl = SCL ) :
+    transactions( 0 ), busy_us( 0 ), m_enabled( false ), m_timeout_us( 0 ), m_hz( 100000 ), m_sda( sda ), m_scl( scl ), m_address( 0 ),
+    m_tx_count( 0 ), m_rx_count( 0 ), m_rx_index( 0 ), m_owed_clocks( 0 ), m_hang_until( 0 ), m_sda_low( false ), m_scl_low( false )
+  {
+    memset( &faults, 0, sizeof( faults ) );
+    memset( m_tx, 0, sizeof( m_tx ) );
+    memset( m_rx, 0, sizeof( m_rx ) );
+    memset( m_devices, 0, sizeof( m_devices ) );
+#ifdef ARDUINO_SAMD_ZERO
+    m_sercom = kHostWireSercom;
+#endif
+  }
+
+  void attach( uint8_t address, HostI2CDevice* device )     { m_devices[address & 0x7F] = device; }
+  bool owns( uint8_t pin ) const              { return pin == m_sda || pin == m_scl; }
+
+  void begin()
+  {
+    m_enabled = true;
+    setClock( 100000 );
+#ifdef ARDUINO_SAMD_ZERO
+    host_sercom( m_sercom )->I2CM.CTRLA.bit.LOWTOUTEN = 0;      // the SERCOM's reset clears it
+#endif
+  }
+
+  void end()                                  { m_enabled = false; }
+
+#ifdef ARDUINO_SAMD_ZERO
+  TwoWire( SERCOM* sercom, uint8_t sda, uint8_t scl ) : TwoWire( sda, scl ) { m_sercom = sercom->index; }
+
+  void onService()                            {}
+  void setClock( uint32_t hz )                { m_hz = hz; }
+  uint32_t clock()                            { return m_hz; }
+#else
+  void setClock( uint32_t hz )                { TWSR = 0; TWBR = (F_CPU / hz - 16) / 2; }
+  uint32_t clock()                            { return F_CPU / (16 + 2 * TWBR); }
+  void setWireTimeout( uint32_t us, bool )    { m_timeout_us = us; }
+#endif
+
+  void beginTransmission( uint8_t address )
+  {
+    m_address  = address;
+    m_tx_count = 0;
+  }
+
+  size_t write( uint8_t value )
+  {
+    if( m_tx_count >= kHostWireBuffer )
+      return 0;
+    m_tx[m_tx_count++] = value;
+    return 1;
+  }
+
+  size_t write( const uint8_t* data, size_t count )
+  {
+    size_t written = 0;
+    while( written < count && write( data[written] ) )
+      written++;
+    return written;
+  }
+
+  uint8_t endTransmission( bool = true )
+  {
+    uint64_t began  = host_micros();
+    uint8_t  sent   = m_tx_count;
+    uint8_t  result = start( sent );
+    HostI2CDevice* device = m_devices[m_address & 0x7F];
+
+    // a slave that got stuck still took the bytes before it lost track
+    if( result == kFault_Stuck && device && sent )
+      device->write( m_tx, 1 + rand() % sent );
+
+    busy_us += host_micros() - began;
+    if( result )
+      return result == kFault_Stuck ? (uint8_t)kWire_Timeout : result;
+    if( !device )
+      return kWire_AddressNack;
+    if( !device->keeps_up( clock() ) )
+      return kWire_DataNack;
+    return device->write( m_tx, sent ) ? 0 : kWire_DataNack;
+  }
+
+  uint8_t requestFrom( uint8_t address, uint8_t count, bool = true )
+  {
+    HostI2CDevice* device = m_devices[address & 0x7F];
+    uint64_t began = host_micros();
+    m_rx_index = 0;
+    m_rx_count = 0;
+    if( count > kHostWireBuffer || start( count ) || !device || !device->keeps_up( clock() ) )
+    {
+      busy_us += host_micros() - began;
+      return 0;
+    }
+
+    m_rx_count = device->read( m_rx, count );
+    busy_us   += host_micros() - began;
+    return m_rx_count;
+  }
+
+  int available()                             { return m_rx_count - m_rx_index; }
+  int read()                                  { return m_rx_index < m_rx_count ? m_rx[m_rx_index++] : -1; }
+
+  // the lines, for when the recovery code has them as plain pins
+  void mode( uint8_t pin, uint8_t mode )
+  {
+    bool low = mode == OUTPUT;
+    if( pin == m_sda )
+      m_sda_low = low;
+    else if( pin == m_scl )
+    {
+      // a stuck slave shifts out one more of the bits it owes on every rising edge
+      if( m_scl_low && !low && m_owed_clocks && !hung() )
+        --m_owed_clocks;
+      m_scl_low = low;
+    }
+  }
+
+  int read( uint8_t pin )
+  {
+    if( pin == m_sda )
+      return !m_sda_low && !m_owed_clocks;
+    if( pin == m_scl )
+      return !m_scl_low && !hung();
+    return HIGH;
+  }
+
+private:
+  enum
+  {
+    kWire_AddressNack = 2,
+    kWire_DataNack    = 3,
+    kWire_Disabled    = 4,
+    kWire_Timeout     = 5,
+    kFault_Stuck      = 0xFF
+  };
+
+  bool     m_enabled;
+  uint32_t m_timeout_us;
+  uint32_t m_hz;
+  uint8_t  m_sda;
+  uint8_t  m_scl;
+  uint8_t  m_address;
+  uint8_t  m_tx[kHostWireBuffer];
+  uint8_t  m_tx_count;
+  uint8_t  m_rx[kHostWireBuffer];
+  uint8_t  m_rx_count;
+  uint8_t  m_rx_index;
+  uint8_t  m_owed_clocks;
+  uint64_t m_hang_until;
+  bool     m_sda_low;
+  bool     m_scl_low;
+  HostI2CDevice* m_devices[128];
+#ifdef ARDUINO_SAMD_ZERO
+  uint8_t  m_sercom;
+#endif
+
+  bool hung()                                 { return host_micros() < m_hang_until; }
+
+  uint32_t bytes_us( uint16_t bytes )         { return (uint32_t)(bytes * 9 * 1000000ULL / clock()); }
+
+  // how long the master sits on a line it can't move before it gives up
+  uint32_t wait_limit( bool scl )
+  {
+#ifdef ARDUINO_SAMD_ZERO
+    if( !scl )
+      return 0;     // SDA held low loses the arbitration on the next 1 bit
+    return host_sercom( m_sercom )->I2CM.CTRLA.bit.LOWTOUTEN ? kHostLowTimeoutUS : kHostI2CHang;
+#else
+    (void)scl;
+    return m_timeout_us ? m_timeout_us : kHostI2CHang;
+#endif
+  }
+
+  // the master waits on a line it can't move, until it gives up
+  uint8_t wait_out( uint64_t until, bool scl )
+  {
+    uint64_t limit = host_micros() + wait_limit( scl );
+    host_micros()  = until < limit ? until : limit;
+    return kWire_Timeout;
+  }
+
+  // moves the clock on for an address byte and count data bytes, returns 0 when they went through
+  uint8_t start( uint8_t count )
+  {
+    if( !m_enabled )
+      return kWire_Disabled;
+    transactions++;
+
+    if( hung() )
+    {
+      wait_out( m_hang_until, true );
+      if( hung() )
+        return kWire_Timeout;
+    }
+    if( m_owed_clocks )
+      return wait_out( ~0ULL, false );    // nobody lets go of SDA until the recovery clocks it free
+
+    uint32_t roll = rand() % 10000;
+    if( roll < faults.nack )
+    {
+      host_micros() += bytes_us( 1 + rand() % (count + 1) );
+      return kWire_AddressNack;
+    }
+    roll -= faults.nack;
+
+    if( roll < faults.stuck )
+    {
+      host_micros() += bytes_us( 1 + rand() % (count + 1) );
+      m_owed_clocks  = 1 + rand() % 9;
+      wait_out( ~0ULL, false );
+      return kFault_Stuck;
+    }
+    roll -= faults.stuck;
+
+    if( roll < faults.hang )
+    {
+      host_micros() += bytes_us( 1 + rand() % (count + 1) );
+      m_hang_until   = host_micros() + faults.hang_us;
+      return wait_out( m_hang_until, true );
+    }
+    roll -= faults.hang;
+
+    if( roll < faults.stretch )
+    {
+      if( faults.stretch_us > wait_limit( true ) )
+        return wait_out( ~0ULL, true );
+      host_micros() += faults.stretch_us;
+    }
+
+    host_micros() += bytes_us( 1 + count );
+    return 0;
+  }
+};
+
+extern TwoWire Wire;
+#ifdef SECOND_I2C_BUS
+extern TwoWire Wire1;     // i2c_clock.cpp has it
+#endif
+
+
+#endif // host_wire_h
+// EOF
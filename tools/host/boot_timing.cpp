@@ -0,0 +1,147 @@
+//
+//  boot_timing.cpp
+//
+//  Times the sketch's display bring-up (display_controller.cpp and i2c_clock.cpp as they are) on
+//  the simulated bus, from reset to the first frame on show, for a cold boot where the IS31FL3731s
+//  come up blank and for a warm restart where only the MCU reset and the controllers kept their
+//  setup.  Only bus time is counted, that is all the simulated clock moves for - on the board the
+//  profiler's boot stage adds the first render on top (see profiler.h).
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h and Wire.h win):
+//
+//    c++ -std=c++11 -O2 -Itools/host -I. tools/host/boot_timing.cpp display_controller.cpp i2c_clock.cpp brightness.cpp -o boot_timing
+//
+//  Exits with 1 when a boot doesn't end with the first frame on every panel.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Wire.h>
+
+#include "display_controller.h"
+#include "i2c_clock.h"
+#include "panel_map.h"
+#include "brightness.h"
+#include "is31_model.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kSimWidth       = 16;
+static const uint8_t  kSimHeight      = 18;
+static const uint8_t  kSimPanels      = 2;
+static const uint8_t  kSimFirstFrame  = 77;     // a flat field, so it is easy to spot on the panels
+
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, 0 >          SimLayout1;
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, Matrix16x9Wiring::kHeight > SimLayout2;
+typedef GammaCurve< 100 >                                          SimCurve;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t setup_us;          // display_setup() on every panel
+  uint32_t calibrate_us;      // display_calibrate()
+  uint32_t first_frame_us;    // buffer_frames() and display_present()
+  uint32_t transactions;
+} BootTiming;
+
+
+// Constants and static data ---------------------------------------------
+
+TwoWire               Wire;
+
+static IS31Model      s_models[kSimPanels];
+static DisplayPanel   s_panels[kSimPanels] =
+{
+  { 0x74, 0, 0, SimLayout1::table(), SimCurve::table() },
+  { 0x77, 0, 0, SimLayout2::table(), SimCurve::table() },
+};
+
+
+// Private API -----------------------------------------------------------------
+
+bool     boot( uint8_t panels, BootTiming* timing );
+void     print_timing( const char* name, uint8_t panels, const BootTiming* timing );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+// the same order as the sketch's setup() and its first pass through the tasks
+bool boot( uint8_t panels, BootTiming* timing )
+{
+  static uint8_t buff[kSimWidth * kSimHeight];
+
+  // the MCU's RAM doesn't survive a reset, the controllers' registers do
+  host_micros() = 0;
+  Wire = TwoWire();
+  for( uint8_t p = 0; p < panels; p++ )
+  {
+    Wire.attach( s_panels[p].address, &s_models[p] );
+    s_panels[p].page      = 0;
+    s_panels[p].stale     = 0;
+    s_panels[p].lut_level = 0;
+    memset( s_panels[p].lut, 0, sizeof( s_panels[p].lut ) );
+  }
+
+  i2c_begin();
+  for( uint8_t p = 0; p < panels; p++ )
+    display_setup( s_panels[p].bus, s_panels[p].address, &s_panels[p].page );
+  timing->setup_us = (uint32_t)host_micros();
+
+  display_calibrate( s_panels, panels );
+  display_queue_reset( s_panels );
+  timing->calibrate_us = (uint32_t)host_micros() - timing->setup_us;
+
+  memset( buff, kSimFirstFrame, sizeof( buff ) );
+  buffer_frames( s_panels, panels, buff );
+  display_present( s_panels, panels );
+  timing->first_frame_us = (uint32_t)host_micros() - timing->setup_us - timing->calibrate_us;
+  timing->transactions   = Wire.transactions;
+
+  bool shown = true;
+  for( uint8_t p = 0; p < panels; p++ )
+    shown &= s_models[p].lit() && s_models[p].shown_pwm()[0] == SimCurve::value( kSimFirstFrame );
+  return shown;
+}
+
+
+void print_timing( const char* name, uint8_t panels, const BootTiming* timing )
+{
+  printf( "%-14s %u  %9u %9u %9u %9u %8u\n", name, panels, timing->setup_us, timing->calibrate_us, timing->first_frame_us,
+          timing->setup_us + timing->calibrate_us + timing->first_frame_us, timing->transactions );
+}
+
+
+#pragma mark -
+
+int main()
+{
+  host_pins() = &Wire;
+
+  printf( "bus time from reset to the first frame on show, %u MHz AVR\n\n", (unsigned)(F_CPU / 1000000) );
+  printf( "%-14s %s  %9s %9s %9s %9s %8s\n", "boot", "n", "setup us", "cal us", "frame us", "total us", "xfers" );
+
+  bool ok = true;
+  for( uint8_t panels = 1; panels <= kSimPanels; panels++ )
+  {
+    for( uint8_t p = 0; p < kSimPanels; p++ )
+      s_models[p] = IS31Model();      // powered up from cold
+
+    BootTiming cold, warm;
+    ok &= boot( panels, &cold );
+    ok &= boot( panels, &warm );      // the same controllers again, they kept their setup
+    print_timing( "cold", panels, &cold );
+    print_timing( "warm restart", panels, &warm );
+  }
+
+  if( !ok )
+    printf( "\nA BOOT DIDN'T END WITH THE FIRST FRAME ON SHOW\n" );
+  return ok ? 0 : 1;
+}
+
+// EOF
@@ -0,0 +1,143 @@
+//
+//  flicker_bench.cpp
+//
+//  Frame cost of the flicker engine against its channel count: flickering_lights_tick() and then
+//  flickering_lights_draw() into a two panel (16x18) render buffer, on a virtual clock stepping at
+//  the sketch's frame rate so the effects run through their states like they do on the jar.  The
+//  first channel is the flicker pin as always, every other one is a 2x2 region of the matrix.
+//  Host numbers, so only the shape of the curve carries over to the M0, not the absolute times.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins), as
+//  the M0 so there are 64 channels to go round:
+//
+//    c++ -std=c++11 -O2 -DARDUINO_SAMD_ZERO -Itools/host -I. tools/host/flicker_bench.cpp flickering_lights.cpp brightness.cpp -o flicker_bench
+//
+//    flicker_bench                         1, 16 and 64 channels, 200000 frames each
+//    flicker_bench --frames 1000000 --fps 60
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "flickering_lights.h"
+#include "pixel_kernels.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kBenchWidth   = 16;
+static const uint8_t  kBenchHeight  = 18;
+static const uint8_t  kBenchTile    = 2;      // each region channel gets a tile this size
+static const uint8_t  kBenchTilesX  = kBenchWidth / kBenchTile;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t frames;
+  float    fps;
+} BenchOptions;
+
+
+// Private API -----------------------------------------------------------------
+
+bool     setup_channels( uint8_t channels );
+double   frame_ns( const BenchOptions* options );
+bool     parse_options( int argc, char** argv, BenchOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+bool setup_channels( uint8_t channels )
+{
+  host_micros() = 0;
+  randomSeed( 1 );
+  flickering_lights_setup();
+
+  for( uint8_t i = 1; i < channels; i++ )
+  {
+    uint8_t tile = i - 1;
+    uint8_t x    = (tile % kBenchTilesX) * kBenchTile;
+    uint8_t y    = (tile / kBenchTilesX) * kBenchTile;
+    if( flickering_lights_add_region( x, y, kBenchTile, kBenchTile, kBenchWidth, kBenchHeight ) < 0 )
+      return false;
+  }
+
+  return flickering_lights_channel_count() == channels;
+}
+
+
+double frame_ns( const BenchOptions* options )
+{
+  static uint8_t kPixelAlign buff[kBenchWidth * kBenchHeight];
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for( uint32_t f = 0; f < options->frames; f++ )
+  {
+    host_micros() = (uint64_t)(f * 1000000.0 / options->fps);
+    flickering_lights_tick();
+    flickering_lights_draw( buff, kBenchWidth );
+  }
+  std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+
+  return elapsed.count() / options->frames;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, BenchOptions* options )
+{
+  options->frames = 200000;
+  options->fps    = 30;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--fps" ) )
+      options->fps = atof( value );
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->frames > 0 && options->fps > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  BenchOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: flicker_bench [--frames N] [--fps F]\n" );
+    return 1;
+  }
+
+  static const uint8_t s_counts[] = { 1, 16, 64 };
+
+  printf( "%ux%u, %u frames at %.0f fps per row\n", kBenchWidth, kBenchHeight, options.frames, options.fps );
+  for( uint8_t i = 0; i < sizeof( s_counts ); i++ )
+  {
+    if( !setup_channels( s_counts[i] ) )
+    {
+      fprintf( stderr, "couldn't set up %u channels, only %u (built without -DARDUINO_SAMD_ZERO?)\n", s_counts[i], flickering_lights_channel_count() );
+      return 1;
+    }
+
+    double ns = frame_ns( &options );
+    printf( "%4u channels: %8.0f ns a frame  (%5.1f ns a channel)\n", s_counts[i], ns, ns / s_counts[i] );
+  }
+
+  return 0;
+}
+
+// EOF
@@ -0,0 +1,354 @@
+//
+//  gesture_bench.cpp
+//
+//  Feeds the gesture recogniser a scripted accelerometer stream: the jar at rest, being played with,
+//  knocked, shaken, tilted and held, flipped, and left lying upside down.  Checks each stretch of the
+//  script produced the gesture it should (and nothing else), then times the recogniser per sample.
+//  The stream is what the LIS3DH would read on each accelerometer mount, and goes through
+//  panel_remap_accel() and panel_accel_up() the way the sketch sends it, so a mount whose axes come
+//  out wrong fails here.
+//  Host numbers, the M0 and the Pro Trinket are a good deal slower, but it's all 16/32 bit integer work.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins):
+//
+//    c++ -std=c++11 -O2 -Itools/host -I. tools/host/gesture_bench.cpp gesture.cpp -o gesture_bench
+//
+//    gesture_bench                         3 noise seeds on each mount, then timing over 10 million samples
+//    gesture_bench --runs 20 --samples 50000000
+//
+//  Exits with 1 when any run misses a gesture or finds one that wasn't there.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "gesture.h"
+#include "panel_map.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const float    kSampleHz       = 100;        // the sketch's accel task
+static const float    kNoiseG         = 0.03f;      // LIS3DH noise at 100 Hz is about this, plus a little hand tremor
+static const float    kDegrees        = 3.14159265f / 180;
+
+enum
+{
+  kMotion_Rest = 0,
+  kMotion_Play,         // slow leaning back and forth like people do to watch the dots move, and the odd knock
+  kMotion_Shake,
+  kMotion_TiltRight,
+  kMotion_TiltLeft,
+  kMotion_Flip,         // over and straight back
+  kMotion_LaidDown      // turned over and left there
+};
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  const char* name;
+  uint8_t     motion;
+  float       seconds;
+  uint8_t     expected;     // kGesture_None means it should see nothing at all
+} Segment;
+
+
+typedef struct
+{
+  int16_t  x;           // sensor axes, raw counts
+  int16_t  y;
+  int16_t  z;
+  uint16_t segment;
+} Sample;
+
+
+typedef struct
+{
+  uint32_t runs;
+  uint32_t samples;
+} BenchOptions;
+
+
+// Constants and static data ---------------------------------------------
+
+static const Segment  s_script[] =
+{
+  { "settle",       kMotion_Rest,      2.0f, kGesture_None      },
+  { "rest",         kMotion_Rest,      3.0f, kGesture_None      },
+  { "play",         kMotion_Play,     12.0f, kGesture_None      },
+  { "shake",        kMotion_Shake,     1.2f, kGesture_Shake     },
+  { "rest",         kMotion_Rest,      2.0f, kGesture_None      },
+  { "tilt right",   kMotion_TiltRight, 3.0f, kGesture_TiltRight },
+  { "rest",         kMotion_Rest,      2.0f, kGesture_None      },
+  { "tilt left",    kMotion_TiltLeft,  3.0f, kGesture_TiltLeft  },
+  { "rest",         kMotion_Rest,      2.0f, kGesture_None      },
+  { "flip",         kMotion_Flip,      1.8f, kGesture_Flip      },
+  { "rest",         kMotion_Rest,      2.0f, kGesture_None      },
+  { "laid down",    kMotion_LaidDown,  6.0f, kGesture_None      },
+  { "rest",         kMotion_Rest,      2.0f, kGesture_None      },
+  { "long shake",   kMotion_Shake,     4.0f, kGesture_Shake     },
+  { "play",         kMotion_Play,      8.0f, kGesture_None      },
+};
+static const uint16_t kSegmentCount = sizeof( s_script ) / sizeof( s_script[0] );
+
+static const char*    s_gesture_names[kGestureCount] = { "none", "shake", "flip", "tilt left", "tilt right" };
+
+static const uint8_t  s_mounts[]      = { kAccelMount_Standing, kAccelMount_Flat };
+static const char*    s_mount_names[] = { "standing", "flat" };
+static const uint8_t  kMountCount     = sizeof( s_mounts ) / sizeof( s_mounts[0] );
+
+
+// Private API -----------------------------------------------------------------
+
+void     script_stream( uint8_t mount, uint32_t seed, std::vector< Sample >* stream );
+void     motion_at( uint8_t motion, float t, float length, float* across, float* up, float* through );
+void     sensor_axes( uint8_t mount, float across, float up, float through, float* sx, float* sy, float* sz );
+void     setup_mount( uint8_t mount );
+uint8_t  sample( uint8_t mount, const Sample* s );
+float    ramp( float t, float length, float edge );
+float    noise();
+bool     check_run( uint8_t mount, uint32_t seed, bool verbose );
+double   sample_ns( uint8_t mount, const std::vector< Sample >* stream, uint32_t samples );
+bool     parse_options( int argc, char** argv, BenchOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+float noise()
+{
+  return ((rand() % 2001) - 1000) * (kNoiseG / 1000);
+}
+
+
+// 0 up to 1 over edge seconds at the start, back down over the end
+float ramp( float t, float length, float edge )
+{
+  float up   = t / edge;
+  float down = (length - t) / edge;
+  float v    = up < down ? up : down;
+  return v < 0 ? 0 : (v > 1 ? 1 : v);
+}
+
+
+// what the accelerometer reads in the jar's own axes, in g: up reads +1 at rest, across is along the
+// panel's x, through the remaining axis
+void motion_at( uint8_t motion, float t, float length, float* across, float* up, float* through )
+{
+  float lean = 0;     // about z, positive leans gravity towards +x
+  float roll = 0;     // about x, 180 degrees is upside down
+  float push = 0;     // movement along x on top of gravity
+
+  switch( motion )
+  {
+    case kMotion_Play:
+      lean = 25 * kDegrees * sinf( t * 2 * 3.14159265f * 0.3f );
+      roll = 15 * kDegrees * sinf( t * 2 * 3.14159265f * 0.17f );
+      if( fmodf( t, 3.0f ) < 0.02f )
+        push = 1.5f;                                              // a knock on the shelf
+      break;
+
+    case kMotion_Shake:
+      push = 1.8f * sinf( t * 2 * 3.14159265f * 4.5f ) * ramp( t, length, 0.1f );
+      break;
+
+    case kMotion_TiltRight:
+    case kMotion_TiltLeft:
+      lean = (motion == kMotion_TiltRight ? 55 : -55) * kDegrees * ramp( t, length, 0.4f );
+      break;
+
+    case kMotion_Flip:
+    case kMotion_LaidDown:
+      roll = 180 * kDegrees * ramp( t, length, 0.5f );
+      break;
+  }
+
+  // gravity turned by the lean and roll
+  *across  = sinf( lean ) + push;
+  *up      = cosf( lean ) * cosf( roll );
+  *through = cosf( lean ) * sinf( roll );
+}
+
+
+// the jar's axes as the LIS3DH sees them on each mount, the other way round from panel_remap_accel()
+void sensor_axes( uint8_t mount, float across, float up, float through, float* sx, float* sy, float* sz )
+{
+  if( mount == kAccelMount_Flat )
+  {
+    *sx = through;
+    *sy = across;
+    *sz = up;
+  }
+  else
+  {
+    *sx = through;
+    *sy = up;
+    *sz = across;
+  }
+}
+
+
+// what the sketch's setup() and accel_task() do
+void setup_mount( uint8_t mount )
+{
+  uint8_t up_axis;
+  int8_t  up_sign;
+  panel_accel_up( mount, kPanelRotate_0, kPanelMirror_None, &up_axis, &up_sign );
+  gesture_setup( up_axis, up_sign );
+}
+
+
+uint8_t sample( uint8_t mount, const Sample* s )
+{
+  int16_t x, y, z;
+  panel_remap_accel( mount, kPanelRotate_0, kPanelMirror_None, s->x, s->y, s->z, &x, &y, &z );
+  return gesture_sample( x, y, z );
+}
+
+
+void script_stream( uint8_t mount, uint32_t seed, std::vector< Sample >* stream )
+{
+  srand( seed );
+  stream->clear();
+
+  for( uint16_t s = 0; s < kSegmentCount; s++ )
+  {
+    uint32_t count = (uint32_t)(s_script[s].seconds * kSampleHz);
+    for( uint32_t i = 0; i < count; i++ )
+    {
+      float across, up, through, x, y, z;
+      motion_at( s_script[s].motion, i / kSampleHz, s_script[s].seconds, &across, &up, &through );
+      sensor_axes( mount, across, up, through, &x, &y, &z );
+
+      Sample sample;
+      sample.x       = (int16_t)((x + noise()) * kGestureInputOneG);
+      sample.y       = (int16_t)((y + noise()) * kGestureInputOneG);
+      sample.z       = (int16_t)((z + noise()) * kGestureInputOneG);
+      sample.segment = s;
+      stream->push_back( sample );
+    }
+  }
+}
+
+
+bool check_run( uint8_t mount, uint32_t seed, bool verbose )
+{
+  std::vector< Sample > stream;
+  script_stream( mount, seed, &stream );
+
+  std::vector< uint8_t > found( kSegmentCount, 0 );
+  std::vector< uint8_t > seen( kSegmentCount, kGesture_None );
+  bool ok = true;
+
+  setup_mount( mount );
+  for( size_t i = 0; i < stream.size(); i++ )
+  {
+    uint8_t gesture = sample( mount, &stream[i] );
+    if( !gesture )
+      continue;
+
+    // a gesture can finish just after its stretch of the script ends, on the way back to rest
+    uint16_t segment = stream[i].segment;
+    if( !s_script[segment].expected && segment && s_script[segment - 1].expected == gesture && !found[segment - 1] )
+      segment--;
+
+    found[segment]++;
+    seen[segment] = gesture;
+  }
+
+  for( uint16_t s = 0; s < kSegmentCount; s++ )
+  {
+    bool right = s_script[s].expected ? (found[s] == 1 && seen[s] == s_script[s].expected) : !found[s];
+    ok &= right;
+    if( verbose || !right )
+    {
+      printf( "  %-12s expected %-10s found %u %-10s %s\n", s_script[s].name, s_gesture_names[s_script[s].expected],
+              found[s], found[s] ? s_gesture_names[seen[s]] : "", right ? "" : "<--" );
+    }
+  }
+
+  return ok;
+}
+
+
+double sample_ns( uint8_t mount, const std::vector< Sample >* stream, uint32_t samples )
+{
+  uint32_t gestures = 0;
+
+  setup_mount( mount );
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for( uint32_t done = 0; done < samples; )
+  {
+    gesture_reset();
+    for( size_t i = 0; i < stream->size() && done < samples; i++, done++ )
+      gestures += sample( mount, &(*stream)[i] ) != kGesture_None;
+  }
+  std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+
+  if( !gestures )
+    printf( "no gestures while timing?\n" );     // also keeps the loop from being thrown away
+  return elapsed.count() / samples;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, BenchOptions* options )
+{
+  options->runs    = 3;
+  options->samples = 10000000;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--runs" ) )
+      options->runs = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--samples" ) )
+      options->samples = strtoul( value, NULL, 0 );
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->runs > 0 && options->samples > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  BenchOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: gesture_bench [--runs N] [--samples N]\n" );
+    return 1;
+  }
+
+  bool ok = true;
+  for( uint8_t m = 0; m < kMountCount; m++ )
+  {
+    for( uint32_t run = 0; run < options.runs; run++ )
+    {
+      printf( "%s mount, noise seed %u\n", s_mount_names[m], run + 1 );
+      ok &= check_run( s_mounts[m], run + 1, run == 0 );
+    }
+  }
+
+  // the production mount, remap included since the sketch pays for it too
+  std::vector< Sample > stream;
+  script_stream( kAccelMount_Standing, 1, &stream );
+  double ns = sample_ns( kAccelMount_Standing, &stream, options.samples );
+  printf( "\n%s, %.1f ns a sample (%u samples), %.4f%% of the %.0f ms sample period\n", ok ? "all gestures found" : "MISSED OR FALSE GESTURES",
+          ns, options.samples, ns / (10000000.0 / kSampleHz), 1000 / kSampleHz );
+
+  return ok ? 0 : 1;
+}
+
+// EOF
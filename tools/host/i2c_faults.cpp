@@ -0,0 +1,239 @@
+//
+//  i2c_faults.cpp
+//
+//  Runs the real display upload (display_controller.cpp and i2c_clock.cpp) against two simulated
+//  IS31FL3731s on a simulated bus, with faults injected into it, and checks that a frame's upload
+//  stays inside its time bound and that a panel never shows a page that only got part of a frame.
+//  Every scenario prints the upload latency, what the panels showed and the fault counters.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h and Wire.h win):
+//
+//    c++ -std=c++11 -O2 -Itools/host -I. tools/host/i2c_faults.cpp display_controller.cpp i2c_clock.cpp brightness.cpp -o i2c_faults
+//
+//    i2c_faults                            every scenario, 3000 frames each
+//    i2c_faults --frames 20000 --seed 7
+//
+//  Exits with 1 when any scenario breaks the latency bound or tears a frame.
+//
+//  Built with -DARDUINO_SAMD_ZERO it runs the M0's Wire instead, whose only timeout is the SERCOM's
+//  25-35 ms SCL low timeout - the scenarios that hold SCL break the AVR's bound there by design,
+//  what to look for is that nothing hangs.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Wire.h>
+
+#include "display_controller.h"
+#include "i2c_clock.h"
+#include "panel_map.h"
+#include "brightness.h"
+#include "is31_model.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kSimWidth       = 16;
+static const uint8_t  kSimHeight      = 18;
+static const uint8_t  kSimPanels      = 2;
+static const uint32_t kSimFramePeriodUS = 33333;
+
+// the budget, then the transaction in flight when it ran out plus a retry that was already on its
+// way, and a bus recovery (nine clocks and a STOP at 100 kHz with a little slack)
+static const uint32_t kLatencyBoundUS = kI2CFrameBudgetUS + 2 * kI2CTimeoutUS + 500;
+
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, 0 >          SimLayout1;
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, Matrix16x9Wiring::kHeight > SimLayout2;
+
+// a straight line, so every frame's value still tells it apart from its neighbours on the panel
+typedef GammaCurve< 100 >                                          SimCurve;
+
+static_assert( kLatencyBoundUS < kSimFramePeriodUS, "a faulty frame could run into the next one" );
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  const char*   name;
+  HostI2CFaults faults;
+} Scenario;
+
+
+typedef struct
+{
+  uint32_t frames;
+  uint32_t seed;
+} SimOptions;
+
+
+// Constants and static data ---------------------------------------------
+
+TwoWire               Wire;
+
+static const Scenario s_scenarios[] =
+{
+  { "clean",       { 0,   0,  0,    0,    0, 0      } },
+  { "nacks",       { 200, 0,  0,    0,    0, 0      } },
+  { "stuck sda",   { 0,   50, 0,    0,    0, 0      } },
+  { "stretching",  { 0,   0,  1000, 2500, 0, 0      } },
+  { "long stalls", { 0,   0,  200,  8000, 0, 0      } },
+  { "scl held",    { 0,   0,  0,    0,    5, 150000 } },
+  { "everything",  { 100, 30, 300,  4000, 3, 60000  } },
+};
+static const uint8_t  kScenarioCount = sizeof( s_scenarios ) / sizeof( s_scenarios[0] );
+
+
+// Private API -----------------------------------------------------------------
+
+bool     run_scenario( const Scenario* scenario, const SimOptions* options );
+uint8_t  shown_value( const IS31Model* model, bool* torn );
+bool     parse_options( int argc, char** argv, SimOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+// every frame is a flat field, so a page that only got part of one shows more than one value
+uint8_t shown_value( const IS31Model* model, bool* torn )
+{
+  const uint8_t* pwm = model->shown_pwm();
+  for( uint8_t i = 1; i < kIS31_PWMBytes; i++ )
+  {
+    if( pwm[i] != pwm[0] )
+      *torn = true;
+  }
+  return pwm[0];
+}
+
+
+bool run_scenario( const Scenario* scenario, const SimOptions* options )
+{
+  static IS31Model    models[kSimPanels];
+  static DisplayPanel panels[kSimPanels] =
+  {
+    { 0x74, 0, 0, SimLayout1::table(), SimCurve::table() },
+    { 0x77, 0, 0, SimLayout2::table(), SimCurve::table() },
+  };
+
+  // a cold start on a clean bus, the faults come in once the panels are up
+  srand( options->seed );
+  host_micros() = 0;
+  Wire = TwoWire();
+  for( uint8_t p = 0; p < kSimPanels; p++ )
+  {
+    models[p] = IS31Model();
+    Wire.attach( panels[p].address, &models[p] );
+  }
+
+  i2c_begin();
+  for( uint8_t p = 0; p < kSimPanels; p++ )
+  {
+    display_setup( panels[p].bus, panels[p].address, &panels[p].page );
+    panels[p].stale     = 0;
+    panels[p].lut_level = 0;
+  }
+  display_calibrate( panels, kSimPanels );
+  display_queue_reset( panels );
+
+  I2CFaults before = *i2c_faults( 0 );
+  Wire.faults = scenario->faults;
+
+  uint8_t  buff[kSimWidth * kSimHeight];
+  uint8_t  last_shown[kSimPanels] = { 0 };
+  uint32_t worst_us = 0;
+  uint64_t total_us = 0;
+  uint32_t over     = 0;
+  uint32_t torn     = 0;
+  uint32_t repeats  = 0;      // a panel still showing the frame it showed last time
+
+  for( uint32_t frame = 0; frame < options->frames; frame++ )
+  {
+    memset( buff, 40 + frame % 200, sizeof( buff ) );
+
+    // one frame into the queue and one out each period, so a frame is on show the period after it went out
+    uint64_t start = host_micros();
+    if( !display_queue_full() )
+      buffer_frames( panels, kSimPanels, buff );
+    display_present( panels, kSimPanels );
+    uint32_t latency = (uint32_t)(host_micros() - start);
+
+    worst_us  = latency > worst_us ? latency : worst_us;
+    total_us += latency;
+    if( latency > kLatencyBoundUS )
+      over++;
+
+    for( uint8_t p = 0; p < kSimPanels; p++ )
+    {
+      bool    torn_page = false;
+      uint8_t shown     = shown_value( &models[p], &torn_page );
+      torn    += torn_page;
+      repeats += frame && shown == last_shown[p];
+      last_shown[p] = shown;
+    }
+
+    // the next frame starts on time unless this one ran past it
+    uint64_t next = start + kSimFramePeriodUS;
+    if( host_micros() < next )
+      host_micros() = next;
+  }
+
+  const I2CFaults* after = i2c_faults( 0 );
+  printf( "%-12s  %7u %7.0f %8u  %6u %8u  %6u %6u %6u %8u %8u %8u\n", scenario->name,
+          worst_us, (double)total_us / options->frames, over, torn, repeats,
+          after->errors - before.errors, after->timeouts - before.timeouts, after->retries - before.retries,
+          after->recoveries - before.recoveries, after->recovery_us - before.recovery_us, after->skipped - before.skipped );
+
+  return !over && !torn;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, SimOptions* options )
+{
+  options->frames = 3000;
+  options->seed   = 1;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--seed" ) )
+      options->seed = strtoul( value, NULL, 0 );
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->frames > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  SimOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: i2c_faults [--frames N] [--seed N]\n" );
+    return 1;
+  }
+
+  host_pins() = &Wire;
+
+  printf( "%u panels on one bus, %u frames a scenario, upload bound %u us\n\n", kSimPanels, options.frames, kLatencyBoundUS );
+  printf( "%-12s  %7s %7s %8s  %6s %8s  %6s %6s %6s %8s %8s %8s\n", "scenario", "max us", "avg us", "over",
+          "torn", "repeats", "errors", "t/outs", "retry", "recover", "rec us", "skipped" );
+
+  bool ok = true;
+  for( uint8_t s = 0; s < kScenarioCount; s++ )
+    ok &= run_scenario( &s_scenarios[s], &options );
+
+  return ok ? 0 : 1;
+}
+
+// EOF
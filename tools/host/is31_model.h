@@ -0,0 +1,82 @@
+//
+//  is31_model.h
+//
+//  An IS31FL3731 as the tools see it on the simulated bus (see Wire.h): just the registers, eight
+//  frame pages, the function page and the command register's page select.  It keeps them across a
+//  simulated reset of the sketch, like the real chip does when only the MCU restarts.  One can be
+//  given a top clock rate, for a panel on long wires that can't keep up with the rest.
+//
+
+#ifndef is31_model_h
+#define is31_model_h
+
+#include <string.h>
+#include <Wire.h>
+
+#include "display_controller.h"
+
+
+// Data types -----------------------------------------------------------------
+
+class IS31Model : public HostI2CDevice
+{
+public:
+  IS31Model() : m_page( 0 ), m_reg( 0 ), m_max_hz( 0 )
+  {
+    memset( m_frames, 0, sizeof( m_frames ) );
+    memset( m_function, 0, sizeof( m_function ) );
+  }
+
+  bool write( const uint8_t* data, uint8_t count )
+  {
+    if( !count )
+      return true;
+
+    m_reg = data[0];
+    for( uint8_t i = 1; i < count; i++ )
+      store( m_reg++, data[i] );
+    return true;
+  }
+
+  uint8_t read( uint8_t* data, uint8_t count )
+  {
+    for( uint8_t i = 0; i < count; i++ )
+      data[i] = load( m_reg++ );
+    return count;
+  }
+
+  bool keeps_up( uint32_t hz )        { return !m_max_hz || hz <= m_max_hz; }
+  void set_max_clock( uint32_t hz )   { m_max_hz = hz; }
+
+  uint8_t        shown_page() const   { return m_function[kIS31_PictureRegister] & 7; }
+  const uint8_t* shown_pwm() const    { return &m_frames[shown_page()][kIS31_PWM]; }
+  bool           lit() const          { return m_function[kIS31_ShutdownRegister] & 1; }
+
+private:
+  uint8_t  m_page;
+  uint8_t  m_reg;
+  uint32_t m_max_hz;      // 0 for no limit
+  uint8_t  m_frames[8][kIS31_PageSize];
+  uint8_t  m_function[kIS31_FunctionRegisters];
+
+  void store( uint8_t reg, uint8_t value )
+  {
+    if( reg == kIS31_CommandRegister )
+      m_page = value;
+    else if( m_page == kIS31_FunctionPage && reg < kIS31_FunctionRegisters )
+      m_function[reg] = value;
+    else if( m_page < 8 && reg < kIS31_PageSize )
+      m_frames[m_page][reg] = value;
+  }
+
+  uint8_t load( uint8_t reg )
+  {
+    if( m_page == kIS31_FunctionPage )
+      return reg < kIS31_FunctionRegisters ? m_function[reg] : 0;
+    return m_page < 8 && reg < kIS31_PageSize ? m_frames[m_page][reg] : 0;
+  }
+};
+
+
+#endif // is31_model_h
+// EOF
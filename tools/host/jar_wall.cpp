@@ -0,0 +1,291 @@
+//
+//  jar_wall.cpp
+//
+//  Renders a whole installation of jars on the desktop, each one its own PulsingDotsRenderer with
+//  its own seed and its own accelerometer trace, spread over every core with a work stealing pool.
+//  Good for previewing a wall and trying settings out on it much faster than real time.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins):
+//
+//    c++ -std=c++11 -O2 -pthread -Itools/host -I. tools/host/jar_wall.cpp pulsing_dots.cpp -o jar_wall
+//
+//    jar_wall --jars 2000 --frames 600                   render and report jar frames per second
+//    jar_wall --jars 48 --frames 300 --preview wall.pgm   picture of the last frame of every jar
+//    jar_wall --jars 2000 --frames 300 --bench           scaling from one thread up to every core
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#include "pulsing_dots.h"
+#include "pulsing_dots_renderer.h"
+#include "thread_pool.h"
+
+
+// Defines -----------------------------------------------------------------
+
+typedef PulsingDotsRenderer< kDeviceWidth, kDeviceHeight, kMaxDots > JarRenderer;
+
+static const float    kAccelScale     = 0.5f;       // what the sketch uses by default
+static const uint8_t  kPreviewGap     = 2;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t  jars;
+  uint32_t  frames;
+  unsigned  threads;
+  uint8_t   mode;
+  uint8_t   erase_mode;
+  int       max_brightness;     // -1 leaves the default
+  uint32_t  num_steps;          // 0 leaves the default
+  uint32_t  seed;
+  bool      bench;
+  const char* preview;
+} WallOptions;
+
+
+// every jar gets a slow wobble of its own, with the odd knock, all picked from its seed
+typedef struct
+{
+  float     rate;
+  float     phase;
+  float     tilt;
+  uint32_t  knock_every;
+} AccelTrace;
+
+
+typedef struct
+{
+  JarRenderer renderer;
+  AccelTrace  trace;
+  uint32_t    checksum;         // so A/B runs can be told apart without looking at pictures
+} Jar;
+
+
+// Private API -----------------------------------------------------------------
+
+void     jar_setup( Jar* jar, uint32_t index, const WallOptions* options );
+void     jar_render( Jar* jar, uint32_t frames, const WallOptions* options );
+double   render_wall( std::vector< Jar >& jars, unsigned threads, const WallOptions* options, uint64_t* steals );
+bool     write_preview( const char* path, std::vector< Jar >& jars );
+bool     parse_options( int argc, char** argv, WallOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void jar_setup( Jar* jar, uint32_t index, const WallOptions* options )
+{
+  // a different well mixed seed per jar, never zero
+  uint32_t seed = (options->seed + index) * 2654435761u;
+  seed ^= seed >> 16;
+  if( !seed )
+    seed = 1;
+
+  jar->renderer.setup( seed );
+  jar->renderer.set_mode( options->mode );
+  if( options->max_brightness >= 0 )
+    jar->renderer.set_max_brightness( options->max_brightness );
+  if( options->num_steps )
+    jar->renderer.set_num_steps( options->num_steps );
+
+  jar->trace.rate        = 0.01f + (seed % 1000) * 0.00004f;
+  jar->trace.phase       = (seed >> 10) % 628 * 0.01f;
+  jar->trace.tilt        = 0.5f + ((seed >> 20) % 100) * 0.04f;
+  jar->trace.knock_every = 120 + (seed >> 8) % 600;
+  jar->checksum          = 0;
+}
+
+
+void jar_render( Jar* jar, uint32_t frames, const WallOptions* options )
+{
+  const AccelTrace* trace = &jar->trace;
+
+  for( uint32_t f = 0; f < frames; f++ )
+  {
+    // already in screen axes, the sketch does the remapping from the sensor before this point
+    float angle = f * trace->rate + trace->phase;
+    float x     = sinf( angle ) * trace->tilt;
+    float y     = cosf( angle * 0.7f ) * trace->tilt * 0.5f;
+    float z     = (f % trace->knock_every) == 0 ? 6.0f : 0.0f;
+
+    jar->renderer.draw( x * kAccelScale, y * kAccelScale, z * kAccelScale, options->erase_mode );
+  }
+
+  const uint8_t* buff = jar->renderer.get_render_buffer();
+  uint32_t       sum  = 0;
+  for( uint16_t i = 0; i < JarRenderer::kBufferSize; i++ )
+    sum = sum * 31 + buff[i];
+  jar->checksum = sum;
+}
+
+
+double render_wall( std::vector< Jar >& jars, unsigned threads, const WallOptions* options, uint64_t* steals )
+{
+  for( uint32_t i = 0; i < jars.size(); i++ )
+    jar_setup( &jars[i], i, options );
+
+  WorkStealingPool pool( threads );
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  pool.parallel_for( (uint32_t)jars.size(), [&]( uint32_t i ){ jar_render( &jars[i], options->frames, options ); } );
+  std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+
+  if( steals )
+    *steals = pool.steals();
+  return elapsed.count();
+}
+
+
+// every jar's last frame laid out in a roughly square grid, as a greyscale PGM
+bool write_preview( const char* path, std::vector< Jar >& jars )
+{
+  uint32_t columns = (uint32_t)ceil( sqrt( (double)jars.size() * kDeviceHeight / kDeviceWidth ) );
+  if( !columns )
+    columns = 1;
+  uint32_t rows    = (uint32_t)((jars.size() + columns - 1) / columns);
+  uint32_t width   = columns * (kDeviceWidth + kPreviewGap);
+  uint32_t height  = rows * (kDeviceHeight + kPreviewGap);
+
+  std::vector< uint8_t > image( width * height, 0 );
+  for( uint32_t i = 0; i < jars.size(); i++ )
+  {
+    const uint8_t* buff = jars[i].renderer.get_render_buffer();
+    uint32_t       left = (i % columns) * (kDeviceWidth + kPreviewGap);
+    uint32_t       top  = (i / columns) * (kDeviceHeight + kPreviewGap);
+    for( uint8_t y = 0; y < kDeviceHeight; y++ )
+      memcpy( &image[(top + y) * width + left], &buff[y * kDeviceWidth], kDeviceWidth );
+  }
+
+  FILE* file = fopen( path, "wb" );
+  if( !file )
+    return false;
+
+  fprintf( file, "P5\n%u %u\n255\n", width, height );
+  bool ok = fwrite( &image[0], 1, image.size(), file ) == image.size();
+  return fclose( file ) == 0 && ok;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, WallOptions* options )
+{
+  options->jars           = 1000;
+  options->frames         = 300;
+  options->threads        = std::thread::hardware_concurrency();
+  options->mode           = kDotsMode_BlobAccel;
+  options->erase_mode     = kEraseMode_Clear;
+  options->max_brightness = -1;
+  options->num_steps      = 0;
+  options->seed           = 1;
+  options->bench          = false;
+  options->preview        = NULL;
+  if( !options->threads )
+    options->threads = 1;
+
+  for( int i = 1; i < argc; i++ )
+  {
+    const char* arg   = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if( !strcmp( arg, "--bench" ) )
+    {
+      options->bench = true;
+      continue;
+    }
+
+    if( !value )
+      return false;
+    ++i;
+
+    if( !strcmp( arg, "--jars" ) )
+      options->jars = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--threads" ) )
+      options->threads = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--mode" ) )
+      options->mode = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--erase" ) )
+      options->erase_mode = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--max-brightness" ) )
+      options->max_brightness = atoi( value );
+    else if( !strcmp( arg, "--steps" ) )
+      options->num_steps = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--seed" ) )
+      options->seed = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--preview" ) )
+      options->preview = value;
+    else
+      return false;
+  }
+
+  return options->jars && options->threads && options->mode < kDotsModeCount && options->erase_mode <= kEraseMode_Decay;
+}
+
+
+int main( int argc, char** argv )
+{
+  WallOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: jar_wall [--jars N] [--frames N] [--threads N] [--mode N] [--erase N]\n"
+                     "                [--max-brightness N] [--steps N] [--seed N] [--preview FILE.pgm] [--bench]\n" );
+    return 1;
+  }
+
+  std::vector< Jar > jars( options.jars );
+
+  if( options.bench )
+  {
+    // same wall every time, doubling the threads until we run out of cores
+    double single = 0;
+    for( unsigned threads = 1; ; threads *= 2 )
+    {
+      if( threads > options.threads )
+        threads = options.threads;
+
+      uint64_t steals  = 0;
+      double   seconds = render_wall( jars, threads, &options, &steals );
+      double   rate    = (double)options.jars * options.frames / seconds;
+      if( threads == 1 )
+        single = rate;
+
+      printf( "%3u threads: %10.0f jar frames/s  %5.2fx  (%llu steals)\n", threads, rate, rate / single, (unsigned long long)steals );
+      if( threads == options.threads )
+        break;
+    }
+  }
+  else
+  {
+    double seconds = render_wall( jars, options.threads, &options, NULL );
+    double rate    = (double)options.jars * options.frames / seconds;
+    double speed   = rate / options.jars / 30.0;   // against a jar running at 30 fps
+
+    uint32_t wall_sum = 0;
+    for( uint32_t i = 0; i < jars.size(); i++ )
+      wall_sum = wall_sum * 31 + jars[i].checksum;
+
+    printf( "%u jars x %u frames on %u threads: %.3f s, %.0f jar frames/s (%.1fx real time), checksum %08x\n",
+            options.jars, options.frames, options.threads, seconds, rate, speed, wall_sum );
+  }
+
+  if( options.preview && !write_preview( options.preview, jars ) )
+  {
+    fprintf( stderr, "couldn't write %s\n", options.preview );
+    return 1;
+  }
+
+  return 0;
+}
+
+// EOF
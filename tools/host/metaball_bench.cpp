@@ -0,0 +1,153 @@
+//
+//  metaball_bench.cpp
+//
+//  Frame cost of the metaball mode against the number of balls, next to the plain blob mode
+//  drawing the same number of dots, on the two panel (16x18) layout.  Host numbers, so only the
+//  shape of the curve carries over to the M0, not the absolute times.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins):
+//
+//    c++ -std=c++11 -O2 -Itools/host -I. tools/host/metaball_bench.cpp pulsing_dots.cpp -o metaball_bench
+//
+//    metaball_bench                        every dot count, 20000 frames each
+//    metaball_bench --frames 5000 --preview balls.pgm
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "pulsing_dots.h"
+#include "pulsing_dots_renderer.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kBenchWidth   = kDeviceWidth;
+static const uint8_t  kBenchHeight  = kDeviceHeight * 2;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t  frames;
+  uint32_t  seed;
+  const char* preview;
+} BenchOptions;
+
+
+// Private API -----------------------------------------------------------------
+
+template< uint8_t Dots > void bench_dots( const BenchOptions* options );
+template< class Renderer > double frame_ns( Renderer* renderer, uint8_t mode, uint32_t frames );
+bool     write_preview( const char* path, const uint8_t* buff, uint8_t width, uint8_t height );
+bool     parse_options( int argc, char** argv, BenchOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+template< class Renderer >
+double frame_ns( Renderer* renderer, uint8_t mode, uint32_t frames )
+{
+  renderer->set_mode( mode );
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for( uint32_t f = 0; f < frames; f++ )
+    renderer->draw( 0, 0, 0, kEraseMode_Clear );
+  std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+
+  return elapsed.count() / frames;
+}
+
+
+template< uint8_t Dots >
+void bench_dots( const BenchOptions* options )
+{
+  typedef PulsingDotsRenderer< kBenchWidth, kBenchHeight, Dots > Renderer;
+
+  static Renderer renderer;
+  renderer.setup( options->seed );
+  renderer.set_metaball_count( Dots );
+
+  // one warm up pass so the first row isn't paying for cold caches
+  frame_ns( &renderer, kDotsMode_Metaball, options->frames / 10 + 1 );
+
+  double blob     = frame_ns( &renderer, kDotsMode_Blob, options->frames );
+  double metaball = frame_ns( &renderer, kDotsMode_Metaball, options->frames );
+
+  printf( "%4u dots: blob %8.0f ns  metaball %8.0f ns  (%5.1f ns a ball on average)\n", Dots, blob, metaball, metaball / Dots );
+
+  if( options->preview && Dots == kMetaballCount )
+  {
+    if( !write_preview( options->preview, renderer.get_render_buffer(), kBenchWidth, kBenchHeight ) )
+      fprintf( stderr, "couldn't write %s\n", options->preview );
+  }
+}
+
+
+bool write_preview( const char* path, const uint8_t* buff, uint8_t width, uint8_t height )
+{
+  FILE* file = fopen( path, "wb" );
+  if( !file )
+    return false;
+
+  fprintf( file, "P5\n%u %u\n255\n", width, height );
+  bool ok = fwrite( buff, 1, (size_t)width * height, file ) == (size_t)width * height;
+  return fclose( file ) == 0 && ok;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, BenchOptions* options )
+{
+  options->frames  = 20000;
+  options->seed    = 1;
+  options->preview = NULL;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--seed" ) )
+      options->seed = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--preview" ) )
+      options->preview = value;
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->frames > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  BenchOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: metaball_bench [--frames N] [--seed N] [--preview FILE.pgm]\n" );
+    return 1;
+  }
+
+  printf( "%ux%u, radius %u, %u frames per row\n", kBenchWidth, kBenchHeight, kMetaballRadius, options.frames );
+  bench_dots< 1 >( &options );
+  bench_dots< 4 >( &options );
+  bench_dots< 8 >( &options );
+  bench_dots< kMetaballCount >( &options );
+  bench_dots< 16 >( &options );
+  bench_dots< 32 >( &options );
+  bench_dots< 64 >( &options );
+  bench_dots< 100 >( &options );
+  bench_dots< 200 >( &options );
+  return 0;
+}
+
+// EOF
@@ -0,0 +1,335 @@
+//
+//  pixel_check.cpp
+//
+//  Checks the word packed kernels in pixel_kernels.h against plain byte at a time versions: every
+//  pair of bytes through the lane operations (in every lane, next to different neighbours so a
+//  carry leaking between lanes shows up), every rectangle that fits a buffer through
+//  pixel_fill_rect(), and every length through the buffer operations so the stragglers get
+//  covered too.  Then times the buffer operations both ways on a two panel (16x18) buffer.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins).  The
+//  M0 has no vector unit and no memset() that beats a word loop, so keep the compiler from turning
+//  the byte loops into either:
+//
+//    c++ -std=c++11 -O2 -fno-tree-vectorize -fno-tree-loop-distribute-patterns -Itools/host -I. tools/host/pixel_check.cpp -o pixel_check
+//
+//    pixel_check                           every check, then timing over 200000 passes
+//    pixel_check --passes 1000000
+//
+//  Exits with 1 when any kernel disagrees with its byte at a time version.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "pixel_kernels.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint16_t kCheckPixels  = 16 * 18;
+static const uint8_t  kCheckStride  = 16;
+static const uint8_t  kCheckRows    = 18;
+static const uint8_t  kCheckGuard   = 0xA5;     // around the buffers, nothing may write it
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t passes;
+} CheckOptions;
+
+
+// Private API -----------------------------------------------------------------
+
+uint8_t  lane( uint32_t w, uint8_t i );
+uint32_t pack( uint8_t a, uint8_t b, uint8_t c, uint8_t d );
+uint32_t check_lanes();
+uint32_t check_fill_rect();
+uint32_t check_buffers();
+void     time_kernels( uint32_t passes );
+bool     parse_options( int argc, char** argv, CheckOptions* options );
+
+// the byte at a time versions
+void     scalar_scale( uint8_t* buff, uint16_t count, uint16_t factor );
+void     scalar_add_sat( uint8_t* dst, const uint8_t* src, uint16_t count );
+void     scalar_max( uint8_t* dst, const uint8_t* src, uint16_t count );
+void     scalar_fill( uint8_t* buff, uint16_t count, uint8_t value );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+void scalar_scale( uint8_t* buff, uint16_t count, uint16_t factor )
+{
+  for( uint16_t i = 0; i < count; i++ )
+    buff[i] = (buff[i] * factor) >> 8;
+}
+
+
+void scalar_add_sat( uint8_t* dst, const uint8_t* src, uint16_t count )
+{
+  for( uint16_t i = 0; i < count; i++ )
+    dst[i] = dst[i] + src[i] > 255 ? 255 : dst[i] + src[i];
+}
+
+
+void scalar_max( uint8_t* dst, const uint8_t* src, uint16_t count )
+{
+  for( uint16_t i = 0; i < count; i++ )
+    dst[i] = src[i] > dst[i] ? src[i] : dst[i];
+}
+
+
+void scalar_fill( uint8_t* buff, uint16_t count, uint8_t value )
+{
+  for( uint16_t i = 0; i < count; i++ )
+    buff[i] = value;
+}
+
+
+#pragma mark -
+
+uint8_t lane( uint32_t w, uint8_t i )
+{
+  return (w >> (i * 8)) & 0xFF;
+}
+
+
+uint32_t pack( uint8_t a, uint8_t b, uint8_t c, uint8_t d )
+{
+  return a | (b << 8) | (c << 16) | ((uint32_t)d << 24);
+}
+
+
+// every a and b in every lane, each lane offset from the next so its neighbours differ
+uint32_t check_lanes()
+{
+  static const uint8_t s_offset_a[4] = { 0, 67, 131, 200 };
+  static const uint8_t s_offset_b[4] = { 0, 151, 29, 94 };
+
+  uint32_t failures = 0;
+  for( uint16_t a = 0; a < 256; a++ )
+  {
+    for( uint16_t b = 0; b < 256; b++ )
+    {
+      uint8_t la[4], lb[4];
+      for( uint8_t i = 0; i < 4; i++ )
+      {
+        la[i] = a + s_offset_a[i];
+        lb[i] = b + s_offset_b[i];
+      }
+
+      uint32_t wa  = pack( la[0], la[1], la[2], la[3] );
+      uint32_t wb  = pack( lb[0], lb[1], lb[2], lb[3] );
+      uint32_t sum = swar_add_sat( wa, wb );
+      uint32_t max = swar_max( wa, wb );
+
+      for( uint8_t i = 0; i < 4; i++ )
+      {
+        uint16_t want_sum = la[i] + lb[i] > 255 ? 255 : la[i] + lb[i];
+        uint8_t  want_max = la[i] > lb[i] ? la[i] : lb[i];
+        if( lane( sum, i ) != want_sum || lane( max, i ) != want_max )
+        {
+          if( failures++ < 10 )
+            printf( "  lane %u: %3u, %3u gave add %3u max %3u\n", i, la[i], lb[i], lane( sum, i ), lane( max, i ) );
+        }
+      }
+    }
+
+    // swar_scale takes a factor rather than a second pixel, 0..256 inclusive
+    for( uint16_t factor = 0; factor <= 256; factor++ )
+    {
+      uint8_t la[4];
+      for( uint8_t i = 0; i < 4; i++ )
+        la[i] = a + s_offset_a[i];
+
+      uint32_t scaled = swar_scale( pack( la[0], la[1], la[2], la[3] ), factor );
+      for( uint8_t i = 0; i < 4; i++ )
+      {
+        if( lane( scaled, i ) != ((la[i] * factor) >> 8) )
+        {
+          if( failures++ < 10 )
+            printf( "  lane %u: %3u scaled by %3u gave %3u\n", i, la[i], factor, lane( scaled, i ) );
+        }
+      }
+    }
+  }
+
+  return failures;
+}
+
+
+// every rectangle that fits, nothing outside it touched
+uint32_t check_fill_rect()
+{
+  static uint8_t kPixelAlign buff[kCheckPixels];
+  static uint8_t            want[kCheckPixels];
+
+  uint32_t failures = 0;
+  for( uint8_t x = 0; x < kCheckStride; x++ )
+  {
+    for( uint8_t w = 0; x + w <= kCheckStride; w++ )
+    {
+      for( uint8_t y = 0; y < kCheckRows; y += 3 )
+      {
+        for( uint8_t h = 0; y + h <= kCheckRows; h++ )
+        {
+          memset( buff, kCheckGuard, sizeof( buff ) );
+          memset( want, kCheckGuard, sizeof( want ) );
+          for( uint8_t r = y; r < y + h; r++ )
+            memset( &want[r * kCheckStride + x], 0x3C, w );
+
+          pixel_fill_rect( buff, kCheckStride, x, y, w, h, 0x3C );
+          if( memcmp( buff, want, sizeof( buff ) ) )
+          {
+            if( failures++ < 10 )
+              printf( "  fill_rect x %u y %u w %u h %u\n", x, y, w, h );
+          }
+        }
+      }
+    }
+  }
+
+  return failures;
+}
+
+
+// every length up to a whole buffer, so the straggler loops run with 0 to 3 bytes left over
+uint32_t check_buffers()
+{
+  static uint8_t kPixelAlign src[kCheckPixels + 4];
+  static uint8_t kPixelAlign dst[kCheckPixels + 4];
+  static uint8_t kPixelAlign want[kCheckPixels + 4];
+
+  uint32_t failures = 0;
+  for( uint16_t count = 0; count <= kCheckPixels; count++ )
+  {
+    for( uint8_t op = 0; op < 4; op++ )
+    {
+      for( uint16_t i = 0; i < sizeof( src ); i++ )
+      {
+        src[i]  = rand();
+        dst[i]  = i < count ? rand() : kCheckGuard;
+        want[i] = dst[i];
+      }
+
+      uint16_t factor = rand() % 257;
+      switch( op )
+      {
+        case 0: pixel_scale( dst, count, factor );   scalar_scale( want, count, factor );     break;
+        case 1: pixel_add_sat( dst, src, count );    scalar_add_sat( want, src, count );      break;
+        case 2: pixel_max( dst, src, count );        scalar_max( want, src, count );          break;
+        case 3: pixel_fill( dst, count, factor );    scalar_fill( want, count, factor );      break;
+      }
+
+      if( memcmp( dst, want, sizeof( dst ) ) )
+      {
+        static const char* s_names[4] = { "pixel_scale", "pixel_add_sat", "pixel_max", "pixel_fill" };
+        if( failures++ < 10 )
+          printf( "  %s over %u pixels\n", s_names[op], count );
+      }
+    }
+  }
+
+  return failures;
+}
+
+
+#pragma mark -
+
+void time_kernels( uint32_t passes )
+{
+  static uint8_t kPixelAlign src[kCheckPixels];
+  static uint8_t kPixelAlign dst[kCheckPixels];
+  for( uint16_t i = 0; i < kCheckPixels; i++ )
+  {
+    src[i] = rand();
+    dst[i] = rand();
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  double   ns[4][2];
+  uint32_t check = 0;
+
+  for( uint8_t op = 0; op < 4; op++ )
+  {
+    for( uint8_t swar = 0; swar < 2; swar++ )
+    {
+      Clock::time_point start = Clock::now();
+      for( uint32_t p = 0; p < passes; p++ )
+      {
+        // factors and fills that keep the buffer from settling at 0 or 255
+        switch( op )
+        {
+          case 0: swar ? pixel_scale( dst, kCheckPixels, 250 + (p & 7) )  : scalar_scale( dst, kCheckPixels, 250 + (p & 7) );  break;
+          case 1: swar ? pixel_add_sat( dst, src, kCheckPixels )          : scalar_add_sat( dst, src, kCheckPixels );          break;
+          case 2: swar ? pixel_max( dst, src, kCheckPixels )              : scalar_max( dst, src, kCheckPixels );              break;
+          case 3: swar ? pixel_fill( dst, kCheckPixels, p )               : scalar_fill( dst, kCheckPixels, p );               break;
+        }
+        check += dst[p % kCheckPixels];
+      }
+      std::chrono::duration< double, std::nano > elapsed = Clock::now() - start;
+      ns[op][swar] = elapsed.count() / passes;
+    }
+  }
+
+  static const char* s_names[4] = { "scale", "add_sat", "max", "fill" };
+  printf( "\n%u pixels, %u passes          byte ns    word ns\n", kCheckPixels, passes );
+  for( uint8_t op = 0; op < 4; op++ )
+    printf( "  pixel_%-8s             %8.1f   %8.1f   %4.1fx\n", s_names[op], ns[op][0], ns[op][1], ns[op][0] / ns[op][1] );
+
+  if( !check )
+    printf( "(%u)\n", check );      // keeps the loops from being thrown away
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, CheckOptions* options )
+{
+  options->passes = 200000;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--passes" ) )
+      options->passes = strtoul( value, NULL, 0 );
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->passes > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  CheckOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: pixel_check [--passes N]\n" );
+    return 1;
+  }
+
+  srand( 1 );
+
+  uint32_t lanes   = check_lanes();
+  printf( "swar_add_sat, swar_max, swar_scale over every byte pair: %u wrong\n", lanes );
+  uint32_t rects   = check_fill_rect();
+  printf( "pixel_fill_rect over every rectangle in %ux%u: %u wrong\n", kCheckStride, kCheckRows, rects );
+  uint32_t buffers = check_buffers();
+  printf( "buffer operations over 0..%u pixels: %u wrong\n", kCheckPixels, buffers );
+
+  time_kernels( options.passes );
+
+  return lanes || rects || buffers ? 1 : 0;
+}
+
+// EOF
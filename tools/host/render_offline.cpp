@@ -0,0 +1,465 @@
+//
+//  render_offline.cpp
+//
+//  Runs the sketch's frame loop - flicker tick, pulsing_dots_draw(), flicker draw - on a virtual
+//  clock with scripted or recorded accelerometer input and streams the frames out, so hours of
+//  animation can be reviewed without filming the jar.  Rendering and writing run on separate
+//  threads with a small fixed ring of frames between them, memory stays the same however long
+//  the sequence is.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h wins):
+//
+//    c++ -std=c++11 -O2 -pthread -Itools/host -I. tools/host/render_offline.cpp pulsing_dots.cpp flickering_lights.cpp brightness.cpp -o render_offline
+//
+//    render_offline --seconds 3600 --format capture --out hour.bin     replay with dots_telemetry.py replay hour.bin
+//    render_offline --seconds 60 --format y4m --scale 8 --out - | ffplay -
+//    render_offline --frames 900 --accel recorded.txt --format ppm --out - | ffmpeg -f image2pipe -i - out.mp4
+//
+//  A recorded accel file is one "x y z" reading in m/s^2 per line (what the LIS3DH hands the sketch),
+//  one line per frame, looped when it runs out.  Frame rate is reported on stderr.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pulsing_dots.h"
+#include "flickering_lights.h"
+#include "telemetry.h"
+#include "panel_map.h"
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kQueueFrames    = 8;          // frames in flight between the renderer and the writer
+static const float    kAccelScale     = 0.5f;       // the sketch's default
+static const uint8_t  kMaxRegions     = 8;
+
+enum
+{
+  kFormat_Raw = 0,        // bare PWM frames, width * height bytes each
+  kFormat_Capture,        // telemetry frame packets, same as dots_telemetry.py capture
+  kFormat_PPM,            // concatenated binary PPMs, upscaled
+  kFormat_Y4M             // YUV4MPEG2 4:2:0, upscaled
+};
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  uint32_t    frames;
+  float       fps;
+  uint8_t     mode;
+  uint8_t     erase_mode;
+  uint8_t     format;
+  uint8_t     scale;
+  uint32_t    seed;
+  const char* accel_path;
+  const char* out_path;
+  uint8_t     region_count;
+  uint8_t     regions[kMaxRegions][4];
+} OfflineOptions;
+
+
+typedef struct
+{
+  float x;
+  float y;
+  float z;
+} AccelSample;
+
+
+// fixed ring of frame slots, the renderer blocks when it is kQueueFrames ahead of the writer
+class FrameQueue
+{
+public:
+    explicit FrameQueue( uint16_t frame_size ) : m_frame_size( frame_size ), m_storage( frame_size * kQueueFrames ), m_head( 0 ), m_count( 0 ), m_closed( false ), m_high_water( 0 ) {}
+
+    uint8_t* begin_push();                  // waits for a free slot
+    void     end_push();
+    const uint8_t* begin_pop();             // waits for a frame, NULL once closed and drained
+    void     end_pop();
+    void     close();
+    uint8_t  high_water() const             { return m_high_water; }
+
+private:
+    uint16_t                m_frame_size;
+    std::vector< uint8_t >  m_storage;
+    uint8_t                 m_head;         // oldest frame
+    uint8_t                 m_count;
+    bool                    m_closed;
+    uint8_t                 m_high_water;
+    std::mutex              m_lock;
+    std::condition_variable m_changed;
+};
+
+
+// Private API -----------------------------------------------------------------
+
+bool     load_accel( const char* path, std::vector< AccelSample >* samples );
+void     scripted_accel( uint32_t frame, float fps, AccelSample* sample );
+void     writer( FrameQueue* queue, FILE* out, const OfflineOptions* options, bool* ok );
+bool     write_frame( FILE* out, const uint8_t* frame, uint32_t number, const OfflineOptions* options, std::vector< uint8_t >* scratch );
+bool     parse_options( int argc, char** argv, OfflineOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+uint8_t* FrameQueue::begin_push()
+{
+  std::unique_lock< std::mutex > lock( m_lock );
+  m_changed.wait( lock, [this]{ return m_count < kQueueFrames; } );
+  return &m_storage[((m_head + m_count) % kQueueFrames) * m_frame_size];
+}
+
+
+void FrameQueue::end_push()
+{
+  {
+    std::lock_guard< std::mutex > lock( m_lock );
+    ++m_count;
+    if( m_count > m_high_water )
+      m_high_water = m_count;
+  }
+  m_changed.notify_all();
+}
+
+
+const uint8_t* FrameQueue::begin_pop()
+{
+  std::unique_lock< std::mutex > lock( m_lock );
+  m_changed.wait( lock, [this]{ return m_count > 0 || m_closed; } );
+  if( !m_count )
+    return NULL;
+  return &m_storage[m_head * m_frame_size];
+}
+
+
+void FrameQueue::end_pop()
+{
+  {
+    std::lock_guard< std::mutex > lock( m_lock );
+    m_head = (m_head + 1) % kQueueFrames;
+    --m_count;
+  }
+  m_changed.notify_all();
+}
+
+
+void FrameQueue::close()
+{
+  {
+    std::lock_guard< std::mutex > lock( m_lock );
+    m_closed = true;
+  }
+  m_changed.notify_all();
+}
+
+
+#pragma mark -
+
+bool load_accel( const char* path, std::vector< AccelSample >* samples )
+{
+  FILE* file = fopen( path, "r" );
+  if( !file )
+    return false;
+
+  AccelSample sample;
+  while( fscanf( file, "%f %f %f", &sample.x, &sample.y, &sample.z ) == 3 )
+    samples->push_back( sample );
+
+  fclose( file );
+  return !samples->empty();
+}
+
+
+// the jar standing on a shelf: gravity down y, a slow lean back and forth and a knock every so often
+void scripted_accel( uint32_t frame, float fps, AccelSample* sample )
+{
+  float seconds = frame / fps;
+  sample->x = sinf( seconds * 0.4f ) * 2.0f;
+  sample->y = -9.8f;
+  sample->z = cosf( seconds * 0.27f ) * 1.5f;
+  if( (frame % (uint32_t)(fps * 7)) == 0 )
+    sample->z += 6.0f;
+}
+
+
+void writer( FrameQueue* queue, FILE* out, const OfflineOptions* options, bool* ok )
+{
+  std::vector< uint8_t > scratch;
+  uint32_t               number = 0;
+
+  if( options->format == kFormat_Y4M )
+  {
+    // 4:2:0 wants even dimensions, the upscale is padded out with black if need be
+    uint32_t width  = (kMaxWidth * options->scale + 1) & ~1;
+    uint32_t height = (kMaxHeight * options->scale + 1) & ~1;
+    fprintf( out, "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C420jpeg\n", width, height, (uint32_t)(options->fps * 1000) );
+  }
+
+  while( const uint8_t* frame = queue->begin_pop() )
+  {
+    if( *ok && !write_frame( out, frame, number++, options, &scratch ) )
+      *ok = false;        // keep draining so the renderer doesn't block forever
+    queue->end_pop();
+  }
+}
+
+
+bool write_frame( FILE* out, const uint8_t* frame, uint32_t number, const OfflineOptions* options, std::vector< uint8_t >* scratch )
+{
+  uint16_t pixels = (uint16_t)kMaxWidth * kMaxHeight;
+
+  switch( options->format )
+  {
+    case kFormat_Raw:
+      return fwrite( frame, 1, pixels, out ) == pixels;
+
+    case kFormat_Capture:
+    {
+      // one telemetry frame message, see telemetry.h for the layout
+      uint16_t length = 6 + pixels;
+      scratch->resize( 5 + length + 1 );
+      uint8_t* p = &(*scratch)[0];
+      *p++ = kTelemetrySync1;
+      *p++ = kTelemetrySync2;
+      *p++ = kTelemetryMsg_Frame;
+      *p++ = length & 0xFF;
+      *p++ = length >> 8;
+      *p++ = number;
+      *p++ = number >> 8;
+      *p++ = number >> 16;
+      *p++ = number >> 24;
+      *p++ = kMaxWidth;
+      *p++ = kMaxHeight;
+      memcpy( p, frame, pixels );
+
+      uint8_t sum = 0;
+      for( uint16_t i = 2; i < 5 + length; i++ )
+        sum += (*scratch)[i];
+      (*scratch)[5 + length] = sum;
+      return fwrite( &(*scratch)[0], 1, scratch->size(), out ) == scratch->size();
+    }
+
+    case kFormat_PPM:
+    case kFormat_Y4M:
+    {
+      bool     y4m      = options->format == kFormat_Y4M;
+      uint8_t  channels = y4m ? 1 : 3;
+      uint32_t width    = kMaxWidth * options->scale;
+      uint32_t height   = kMaxHeight * options->scale;
+      if( y4m )
+      {
+        width  = (width + 1) & ~1;
+        height = (height + 1) & ~1;
+      }
+
+      // every LED becomes a scale x scale block, the last row and column of each left dark so they read as LEDs
+      uint32_t luma = width * height * channels;
+      uint32_t total = y4m ? luma + (width / 2) * (height / 2) * 2 : luma;
+      scratch->assign( total, 0 );
+      for( uint32_t y = 0; y < kMaxHeight * options->scale; y++ )
+      {
+        for( uint32_t x = 0; x < kMaxWidth * options->scale; x++ )
+        {
+          uint32_t last = options->scale - 1u;
+          bool    gap   = options->scale > 2 && (x % options->scale == last || y % options->scale == last);
+          uint8_t value = gap ? 0 : frame[(y / options->scale) * kMaxWidth + x / options->scale];
+          memset( &(*scratch)[(y * width + x) * channels], value, channels );
+        }
+      }
+
+      if( y4m )
+      {
+        memset( &(*scratch)[luma], 128, total - luma );    // no colour
+        if( fputs( "FRAME\n", out ) < 0 )
+          return false;
+      }
+      else
+        fprintf( out, "P6\n%u %u\n255\n", width, height );
+
+      return fwrite( &(*scratch)[0], 1, total, out ) == total;
+    }
+  }
+
+  return false;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, OfflineOptions* options )
+{
+  options->frames       = 0;
+  options->fps          = 30;
+  options->mode         = kDotsMode_BlobAccel;
+  options->erase_mode   = kEraseMode_Clear;
+  options->format       = kFormat_Raw;
+  options->scale        = 8;
+  options->seed         = 1;
+  options->accel_path   = NULL;
+  options->out_path     = NULL;
+  options->region_count = 0;
+
+  float seconds = 0;
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--seconds" ) )
+      seconds = atof( value );
+    else if( !strcmp( arg, "--fps" ) )
+      options->fps = atof( value );
+    else if( !strcmp( arg, "--mode" ) )
+      options->mode = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--erase" ) )
+      options->erase_mode = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--scale" ) )
+      options->scale = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--seed" ) )
+      options->seed = strtoul( value, NULL, 0 );
+    else if( !strcmp( arg, "--accel" ) )
+      options->accel_path = value;
+    else if( !strcmp( arg, "--out" ) )
+      options->out_path = value;
+    else if( !strcmp( arg, "--format" ) )
+    {
+      static const char* const kFormats[] = { "raw", "capture", "ppm", "y4m" };
+      uint8_t f = 0;
+      while( f < 4 && strcmp( value, kFormats[f] ) )
+        ++f;
+      if( f == 4 )
+        return false;
+      options->format = f;
+    }
+    else if( !strcmp( arg, "--flicker-region" ) )
+    {
+      // x,y,w,h of a matrix area driven by its own flicker channel, it has to lie inside the frame
+      unsigned r[4];
+      if( options->region_count >= kMaxRegions || sscanf( value, "%u,%u,%u,%u", &r[0], &r[1], &r[2], &r[3] ) != 4 )
+        return false;
+      if( !r[2] || !r[3] || r[0] >= kMaxWidth || r[1] >= kMaxHeight || r[2] > kMaxWidth - r[0] || r[3] > kMaxHeight - r[1] )
+      {
+        fprintf( stderr, "flicker region %s has to be an area inside the %ux%u frame\n", value, kMaxWidth, kMaxHeight );
+        return false;
+      }
+      for( uint8_t k = 0; k < 4; k++ )
+        options->regions[options->region_count][k] = r[k];
+      ++options->region_count;
+    }
+    else
+      return false;
+  }
+
+  if( seconds > 0 )
+    options->frames = (uint32_t)(seconds * options->fps + 0.5f);
+
+  return (argc % 2) == 1 && options->frames && options->out_path && options->fps > 0 && options->scale &&
+         options->mode < kDotsModeCount && options->erase_mode <= kEraseMode_Decay;
+}
+
+
+int main( int argc, char** argv )
+{
+  OfflineOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: render_offline (--frames N | --seconds S) --out FILE|- [--fps F] [--format raw|capture|ppm|y4m]\n"
+                     "                      [--scale N] [--mode N] [--erase N] [--seed N] [--accel FILE] [--flicker-region x,y,w,h]\n" );
+    return 1;
+  }
+
+  std::vector< AccelSample > recorded;
+  if( options.accel_path && !load_accel( options.accel_path, &recorded ) )
+  {
+    fprintf( stderr, "couldn't read accel samples from %s\n", options.accel_path );
+    return 1;
+  }
+
+  FILE* out = strcmp( options.out_path, "-" ) ? fopen( options.out_path, "wb" ) : stdout;
+  if( !out )
+  {
+    fprintf( stderr, "couldn't open %s\n", options.out_path );
+    return 1;
+  }
+
+  // same bring up as the sketch's setup(), minus the hardware
+  randomSeed( options.seed );
+  host_micros() = 0;
+  flickering_lights_setup();
+  for( uint8_t i = 0; i < options.region_count; i++ )
+    flickering_lights_add_region( options.regions[i][0], options.regions[i][1], options.regions[i][2], options.regions[i][3], kMaxWidth, kMaxHeight );
+  pulsing_dots_setup();
+  pulsing_dots_set_mode( options.mode );
+
+  uint16_t   frame_size = (uint16_t)kMaxWidth * kMaxHeight;
+  FrameQueue queue( frame_size );
+  bool       written = true;
+  std::thread writing( writer, &queue, out, &options, &written );
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double     render_seconds = 0;
+
+  for( uint32_t frame = 0; frame < options.frames; frame++ )
+  {
+    host_micros() = (uint64_t)(frame * 1000000.0 / options.fps);
+
+    AccelSample sample;
+    if( recorded.empty() )
+      scripted_accel( frame, options.fps, &sample );
+    else
+      sample = recorded[frame % recorded.size()];
+
+    std::chrono::steady_clock::time_point render_start = std::chrono::steady_clock::now();
+
+    // the sketch's loop(), with the jar standing up (Y is up) and the panel unturned
+    float x, y, z;
+    flickering_lights_tick();
+    panel_remap_accel( kAccelMount_Standing, kPanelRotate_0, kPanelMirror_None, sample.x, sample.y, sample.z, &x, &y, &z );
+    pulsing_dots_draw( x * kAccelScale, y * kAccelScale, z * kAccelScale, options.erase_mode );
+    uint8_t* buf = pulsing_dots_get_render_buffer();
+    flickering_lights_draw( buf, kMaxWidth );
+
+    render_seconds += std::chrono::duration< double >( std::chrono::steady_clock::now() - render_start ).count();
+
+    memcpy( queue.begin_push(), buf, frame_size );
+    queue.end_push();
+  }
+
+  queue.close();
+  writing.join();
+  std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+
+  if( out != stdout )
+    written &= fclose( out ) == 0;
+  else
+    written &= fflush( out ) == 0;
+
+  double video_seconds = options.frames / options.fps;
+  fprintf( stderr, "%u frames (%.1f s of animation) in %.3f s: %.0f frames/s overall, %.0f frames/s rendering, %.1fx real time, queue peak %u/%u\n",
+           options.frames, video_seconds, elapsed.count(), options.frames / elapsed.count(),
+           render_seconds > 0 ? options.frames / render_seconds : 0.0, video_seconds / elapsed.count(),
+           queue.high_water(), kQueueFrames );
+
+  if( !written )
+  {
+    fprintf( stderr, "write to %s failed\n", options.out_path );
+    return 1;
+  }
+  return 0;
+}
+
+// EOF
@@ -0,0 +1,178 @@
+//
+//  thread_pool.h
+//
+//  Small work stealing pool for the host tools.  parallel_for() deals the indices out to the
+//  workers in contiguous runs, each worker eats its own run from the front and when it runs dry
+//  steals from the back of somebody else's, so a few slow jars don't leave cores idle.
+//
+
+#ifndef thread_pool_h
+#define thread_pool_h
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Data types -----------------------------------------------------------------
+
+class WorkStealingPool
+{
+public:
+    typedef std::function< void( uint32_t ) > Task;
+
+    explicit WorkStealingPool( unsigned threads );
+    ~WorkStealingPool();
+
+    unsigned size() const                 { return (unsigned)m_workers.size(); }
+    uint64_t steals() const               { return m_steals; }
+
+    // runs task( i ) for every i in [0, count) and returns once they have all finished
+    void     parallel_for( uint32_t count, const Task& task );
+
+private:
+    struct Queue
+    {
+        std::mutex             lock;
+        std::deque< uint32_t > items;
+    };
+
+    void     worker( unsigned self );
+    bool     take( unsigned self, uint32_t* index );
+
+    std::vector< std::thread > m_workers;
+    std::vector< Queue >       m_queues;
+
+    std::mutex                 m_lock;
+    std::condition_variable    m_wake;
+    std::condition_variable    m_done;
+    uint64_t                   m_generation;
+    bool                       m_stop;
+
+    const Task*                m_task;
+    std::atomic< uint32_t >    m_remaining;
+    std::atomic< uint64_t >    m_steals;
+};
+
+
+// Code -----------------------------------------------------------------
+
+inline WorkStealingPool::WorkStealingPool( unsigned threads ) :
+    m_queues( threads ? threads : 1 ),
+    m_generation( 0 ),
+    m_stop( false ),
+    m_task( NULL ),
+    m_remaining( 0 ),
+    m_steals( 0 )
+{
+    for( unsigned i = 0; i < m_queues.size(); i++ )
+        m_workers.push_back( std::thread( &WorkStealingPool::worker, this, i ) );
+}
+
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_lock );
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for( unsigned i = 0; i < m_workers.size(); i++ )
+        m_workers[i].join();
+}
+
+
+inline void WorkStealingPool::parallel_for( uint32_t count, const Task& task )
+{
+    if( !count )
+        return;
+
+    // set up before anything is queued, a worker still spinning down from the last call can grab work early
+    m_task      = &task;
+    m_remaining = count;
+
+    unsigned n = (unsigned)m_queues.size();
+    for( unsigned q = 0; q < n; q++ )
+    {
+        std::lock_guard< std::mutex > lock( m_queues[q].lock );
+        for( uint32_t i = (uint64_t)count * q / n; i < (uint64_t)count * (q + 1) / n; i++ )
+            m_queues[q].items.push_back( i );
+    }
+
+    {
+        std::lock_guard< std::mutex > lock( m_lock );
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    std::unique_lock< std::mutex > lock( m_lock );
+    m_done.wait( lock, [this]{ return m_remaining == 0; } );
+}
+
+
+inline void WorkStealingPool::worker( unsigned self )
+{
+    uint64_t seen = 0;
+    for( ;; )
+    {
+        {
+            std::unique_lock< std::mutex > lock( m_lock );
+            m_wake.wait( lock, [&]{ return m_stop || m_generation != seen; } );
+            if( m_stop )
+                return;
+            seen = m_generation;
+        }
+
+        uint32_t index;
+        while( take( self, &index ) )
+        {
+            (*m_task)( index );
+            if( m_remaining.fetch_sub( 1 ) == 1 )
+            {
+                std::lock_guard< std::mutex > lock( m_lock );
+                m_done.notify_all();
+            }
+        }
+    }
+}
+
+
+inline bool WorkStealingPool::take( unsigned self, uint32_t* index )
+{
+    {
+        Queue& own = m_queues[self];
+        std::lock_guard< std::mutex > lock( own.lock );
+        if( !own.items.empty() )
+        {
+            *index = own.items.front();
+            own.items.pop_front();
+            return true;
+        }
+    }
+
+    // out of our own work, steal the far end of the next busy queue
+    unsigned n = (unsigned)m_queues.size();
+    for( unsigned i = 1; i < n; i++ )
+    {
+        Queue& victim = m_queues[(self + i) % n];
+        std::lock_guard< std::mutex > lock( victim.lock );
+        if( !victim.items.empty() )
+        {
+            *index = victim.items.back();
+            victim.items.pop_back();
+            ++m_steals;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+#endif // thread_pool_h
+// EOF
@@ -0,0 +1,211 @@
+//
+//  two_buses.cpp
+//
+//  What SECOND_I2C_BUS buys a two panel jar, checked without hardware: runs the display upload
+//  (display_controller.cpp and i2c_clock.cpp as they are, built as the M0) with both panels on Wire
+//  and with the second one moved to Wire1, each with every panel able to keep up with 1 MHz and
+//  with the second panel topping out at 600 kHz like one on long wires.
+//
+//  Each bus calibrates its own clock, so a slow panel only holds back the bus it is on - that is
+//  the gain the sketch gets today, since Wire blocks in endTransmission() and the buses are still
+//  sent one after the other.  Next to that it prints how long the frame would take if the two
+//  buses' transfers overlapped (the busier bus's time), which is what an interrupt or DMA driven
+//  SERCOM master would be worth on top.
+//
+//  Build from the top of the repo (this directory has to come first so its Arduino.h and Wire.h win):
+//
+//    c++ -std=c++11 -O2 -DARDUINO_SAMD_ZERO -DSECOND_I2C_BUS -Itools/host -I. tools/host/two_buses.cpp display_controller.cpp i2c_clock.cpp brightness.cpp -o two_buses
+//
+//    two_buses                             1000 frames a layout
+//    two_buses --frames 10000
+//
+//  Exits with 1 when a layout doesn't end with its last frame on both panels.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Wire.h>
+
+#include "display_controller.h"
+#include "i2c_clock.h"
+#include "panel_map.h"
+#include "brightness.h"
+#include "is31_model.h"
+
+#ifndef SECOND_I2C_BUS
+#error build two_buses with -DARDUINO_SAMD_ZERO -DSECOND_I2C_BUS
+#endif
+
+
+// Defines -----------------------------------------------------------------
+
+static const uint8_t  kSimWidth       = 16;
+static const uint8_t  kSimHeight      = 18;
+static const uint8_t  kSimPanels      = 2;
+
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, 0 >          SimLayout1;
+typedef PanelLayout< Matrix16x9Wiring, kSimWidth, 0, Matrix16x9Wiring::kHeight > SimLayout2;
+typedef GammaCurve< 100 >                                          SimCurve;
+
+
+// Data types -----------------------------------------------------------------
+
+typedef struct
+{
+  const char* name;
+  uint8_t     bus;          // the second panel's, the first is always on Wire
+  uint32_t    max_hz;       // the second panel's top rate, 0 for as fast as the bus goes
+} Layout;
+
+
+typedef struct
+{
+  uint32_t frames;
+} SimOptions;
+
+
+// both buses' lines, so the recovery code and i2c_lines_idle() find the right one
+struct BusPins : public HostPins
+{
+  void mode( uint8_t pin, uint8_t mode )  { bus_for( pin )->mode( pin, mode ); }
+  int  read( uint8_t pin )                { return bus_for( pin )->read( pin ); }
+
+  TwoWire* bus_for( uint8_t pin )         { return Wire1.owns( pin ) ? &Wire1 : &Wire; }
+};
+
+
+// Constants and static data ---------------------------------------------
+
+TwoWire               Wire;
+
+static const Layout   s_layouts[] =
+{
+  { "one bus",               0, 0      },
+  { "two buses",             1, 0      },
+  { "one bus, slow panel",   0, 600000 },
+  { "two buses, slow panel", 1, 600000 },
+};
+static const uint8_t  kLayoutCount = sizeof( s_layouts ) / sizeof( s_layouts[0] );
+
+
+// Private API -----------------------------------------------------------------
+
+bool     run_layout( const Layout* layout, const SimOptions* options, double* baseline_us );
+bool     parse_options( int argc, char** argv, SimOptions* options );
+
+
+// Code -----------------------------------------------------------------
+
+#pragma mark -
+
+bool run_layout( const Layout* layout, const SimOptions* options, double* baseline_us )
+{
+  static IS31Model    models[kSimPanels];
+  static DisplayPanel panels[kSimPanels] =
+  {
+    { 0x74, 0, 0, SimLayout1::table(), SimCurve::table() },
+    { 0x77, 0, 0, SimLayout2::table(), SimCurve::table() },
+  };
+  static uint8_t      buff[kSimWidth * kSimHeight];
+
+  host_micros() = 0;
+  Wire  = TwoWire();
+  Wire1 = TwoWire( &sercom1, kI2CBus1SDA, kI2CBus1SCL );
+
+  panels[1].bus = layout->bus;
+  for( uint8_t p = 0; p < kSimPanels; p++ )
+  {
+    models[p] = IS31Model();
+    i2c_bus( panels[p].bus )->attach( panels[p].address, &models[p] );
+    panels[p].stale     = 0;
+    panels[p].lut_level = 0;
+    memset( panels[p].lut, 0, sizeof( panels[p].lut ) );
+  }
+  models[1].set_max_clock( layout->max_hz );
+
+  i2c_begin();
+  for( uint8_t p = 0; p < kSimPanels; p++ )
+    display_setup( panels[p].bus, panels[p].address, &panels[p].page );
+  display_calibrate( panels, kSimPanels );
+  display_queue_reset( panels );
+
+  uint64_t start = host_micros();
+  uint64_t busy0 = Wire.busy_us;
+  uint64_t busy1 = Wire1.busy_us;
+
+  // a frame into the queue and straight out again, the upload as the sketch's tasks do it
+  for( uint32_t frame = 0; frame < options->frames; frame++ )
+  {
+    memset( buff, 40 + frame % 200, sizeof( buff ) );
+    buffer_frames( panels, kSimPanels, buff );
+    display_present( panels, kSimPanels );
+  }
+
+  double frame_us = (double)(host_micros() - start) / options->frames;
+  double bus0_us  = (double)(Wire.busy_us - busy0) / options->frames;
+  double bus1_us  = (double)(Wire1.busy_us - busy1) / options->frames;
+  double overlap  = bus0_us > bus1_us ? bus0_us : bus1_us;
+  if( !*baseline_us )
+    *baseline_us = frame_us;
+
+  char clock1[16] = "-";
+  if( layout->bus )
+    snprintf( clock1, sizeof( clock1 ), "%u", (unsigned)(i2c_calibrated_clock( 1 ) / 1000) );
+  printf( "%-22s %6u %6s  %8.0f %8.0f %8.0f  %8.0f  %5.2fx  %5.2fx\n", layout->name, (unsigned)(i2c_calibrated_clock( 0 ) / 1000), clock1,
+          frame_us, bus0_us, bus1_us, overlap, *baseline_us / frame_us, *baseline_us / overlap );
+
+  uint8_t last = SimCurve::value( 40 + (options->frames - 1) % 200 );
+  return models[0].shown_pwm()[0] == last && models[1].shown_pwm()[0] == last;
+}
+
+
+#pragma mark -
+
+bool parse_options( int argc, char** argv, SimOptions* options )
+{
+  options->frames = 1000;
+
+  for( int i = 1; i + 1 < argc; i += 2 )
+  {
+    const char* arg   = argv[i];
+    const char* value = argv[i + 1];
+
+    if( !strcmp( arg, "--frames" ) )
+      options->frames = strtoul( value, NULL, 0 );
+    else
+      return false;
+  }
+
+  return (argc & 1) && options->frames > 0;     // options come in pairs
+}
+
+
+int main( int argc, char** argv )
+{
+  SimOptions options;
+  if( !parse_options( argc, argv, &options ) )
+  {
+    fprintf( stderr, "usage: two_buses [--frames N]\n" );
+    return 1;
+  }
+
+  static BusPins pins;
+  host_pins() = &pins;
+
+  printf( "two panels, %u frames a layout, times per frame\n\n", options.frames );
+  printf( "%-22s %6s %6s  %8s %8s %8s  %8s  %6s %7s\n", "layout", "kHz 0", "kHz 1", "upload", "bus 0", "bus 1", "overlap", "gain", "if ovl" );
+
+  bool   ok       = true;
+  double baseline = 0;
+  for( uint8_t l = 0; l < kLayoutCount; l++ )
+  {
+    if( l == 2 )
+      baseline = 0;     // the slow panel layouts against each other
+    ok &= run_layout( &s_layouts[l], &options, &baseline );
+  }
+
+  return ok ? 0 : 1;
+}
+
+// EOF
@@ -0,0 +1,25 @@
+//
+//  wiring_private.h
+//
+//  The M0 core's pin mux call, for SECOND_I2C_BUS.  On the desktop the pins are whatever the tool
+//  puts behind host_pins(), so there is nothing to switch.
+//
+
+#ifndef host_wiring_private_h
+#define host_wiring_private_h
+
+#include "Arduino.h"
+
+
+// Defines -----------------------------------------------------------------
+
+#define PIO_SERCOM  2
+
+
+// Public API -----------------------------------------------------------------
+
+inline void pinPeripheral( uint8_t, int )   {}
+
+
+#endif // host_wiring_private_h
+// EOF